@@ -1,29 +1,179 @@
 #include "BMP.h"
 #include "little_endian.h"
+#include "Profiler.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <iostream>
 #include <stdexcept>
+#include <vector>
+
+static_assert(sizeof(Pixel) == 3, "Pixel must match the BMP BGR triple layout");
 
 template <typename T>
-T Read(std::ifstream& file) {
-    char temp[sizeof(T)];
-    file.read(temp, sizeof(T));
-    return ReadLittleEndian<T>(temp);
+T Read(const char*& data) {
+    T result = ReadLittleEndian<T>(data);
+    data += sizeof(T);
+    return result;
 }
 
 template <typename T>
-void Write(std::ofstream& file, T value) {
+void Write(std::ostream& file, T value) {
     file.write(TransformToLittleEndian(value).data(), sizeof(T));
 }
 
-Bmp::Bmp(std::filesystem::path file_name) {
-    CheckInputFileExists(file_name);
-    std::ifstream file(file_name, std::ios_base::binary | std::ios_base::in);
-    bmp_header_ = BmpHeader(file, file_name);
-    dib_header_ = DibHeader(file, file_name);
-    ReadPixelMatrix(file);
+const uint32_t PALETTE_ENTRY_SIZE = 4;
+const uint8_t FIRST_BIT = 0x80;
+
+size_t GetPaddedRowSize(size_t width, uint16_t bits_per_pixel = DibHeader::BITSPERPIXELDEFAULT) {
+    return (width * bits_per_pixel + 31) / 32 * 4;
+}
+
+ImageSize ClampRegion(ImageSize region, const DibHeader& dib_header) {
+    return {std::min(region.width, static_cast<size_t>(dib_header.width_)),
+            std::min(region.height, static_cast<size_t>(dib_header.height_))};
+}
+
+// Seeks forward where the stream allows it and reads through the bytes otherwise, e.g. on a pipe.
+void SkipInput(std::istream& file, size_t bytes) {
+    if (bytes == 0 || !file) {
+        return;
+    }
+    if (!file.seekg(static_cast<std::streamoff>(bytes), std::ios_base::cur)) {
+        file.clear();
+        file.ignore(static_cast<std::streamsize>(bytes));
+    }
+}
+
+// Reads the first width pixels of a scanline and skips the rest of it.
+void ReadScanline(std::istream& file, Pixel* row, size_t width, size_t padded_row_size) {
+    if (GetPaddedRowSize(width) == padded_row_size) {
+        file.read(reinterpret_cast<char*>(row), static_cast<std::streamsize>(padded_row_size));
+        return;
+    }
+    file.read(reinterpret_cast<char*>(row), static_cast<std::streamsize>(width * sizeof(Pixel)));
+    SkipInput(file, padded_row_size - width * sizeof(Pixel));
+}
+
+// Mapped pixels are only read from the file on first access. When profiling, reads a byte of every page, so that
+// the time goes to decoding rather than to the first filter.
+void TouchPages(const Image& image) {
+    const size_t page_size = 4096;
+    volatile uint8_t sink = 0;
+    for (size_t row = 0; row < image.GetHeight(); ++row) {
+        const uint8_t* data = &image.GetRow(row)->blue_;
+        size_t size = image.GetWidth() * sizeof(Pixel);
+        for (size_t offset = 0; offset < size; offset += page_size) {
+            sink = sink + data[offset];
+        }
+    }
+}
+
+void InitHeaders(BmpHeader& bmp_header, DibHeader& dib_header, size_t width, size_t height,
+                 uint16_t bits_per_pixel = DibHeader::BITSPERPIXELDEFAULT) {
+    dib_header.width_ = static_cast<int32_t>(width);
+    dib_header.height_ = static_cast<int32_t>(height);
+    dib_header.bits_per_pixel_ = bits_per_pixel;
+    dib_header.colors_ = DibHeader::GetPaletteSize(bits_per_pixel);
+    dib_header.data_size_ = static_cast<uint32_t>(GetPaddedRowSize(width, bits_per_pixel) * height);
+    bmp_header.offset_ = bmp_header.BMPOFFSETDEFAULT + dib_header.colors_ * PALETTE_ENTRY_SIZE;
+    bmp_header.size_ = bmp_header.offset_ + dib_header.data_size_;
+}
+
+// Spreads the colors evenly from black to white.
+void WritePalette(std::ostream& file, uint32_t colors) {
+    for (uint32_t color = 0; color < colors; ++color) {
+        char gray = static_cast<char>(color * MAX_COLOR / (colors - 1));
+        char entry[PALETTE_ENTRY_SIZE] = {gray, gray, gray, 0};
+        file.write(entry, PALETTE_ENTRY_SIZE);
+    }
+}
+
+bool IsGray(const Pixel& pixel) {
+    return pixel.blue_ == pixel.green_ && pixel.green_ == pixel.red_;
+}
+
+// Fills the first bytes of the scanline, up to its padding.
+void EncodeScanline(const Pixel* row, size_t width, uint16_t bits_per_pixel, char* scanline) {
+    if (bits_per_pixel == DibHeader::BITSPERPIXELDEFAULT) {
+        std::memcpy(scanline, row, width * sizeof(Pixel));
+        return;
+    }
+    if (bits_per_pixel == DibHeader::BITSPERPIXELGRAY) {
+        for (size_t col = 0; col < width; ++col) {
+            if (!IsGray(row[col])) {
+                throw std::invalid_argument("Only gray images can be saved with 8 bits per pixel");
+            }
+            scanline[col] = static_cast<char>(row[col].green_);
+        }
+        return;
+    }
+    std::memset(scanline, 0, (width + 7) / 8);
+    for (size_t col = 0; col < width; ++col) {
+        if (!IsGray(row[col]) || (row[col].green_ != 0 && row[col].green_ != MAX_COLOR)) {
+            throw std::invalid_argument("Only black and white images can be saved with 1 bit per pixel");
+        }
+        if (row[col].green_ != 0) {
+            scanline[col / 8] = static_cast<char>(scanline[col / 8] | (FIRST_BIT >> (col % 8)));
+        }
+    }
+}
+
+// Writes to stdout for STANDARD_STREAM_NAME.
+void WriteFile(const std::filesystem::path& file_name, const std::function<void(std::ostream&)>& write) {
+    if (file_name == STANDARD_STREAM_NAME) {
+        write(std::cout);
+        std::cout.flush();
+        return;
+    }
+    std::ofstream file(file_name, std::ios_base::binary | std::ios_base::out);
+    write(file);
+}
+
+Bmp::Bmp(std::filesystem::path file_name) : Bmp(std::move(file_name), UNBOUNDED_SIZE) {
+}
+
+Bmp::Bmp(std::filesystem::path file_name, ImageSize region) {
+    if (file_name == STANDARD_STREAM_NAME) {
+        {
+            ProfileScope profile("parse header");
+            bmp_header_ = BmpHeader(std::cin, std::nullopt);
+            dib_header_ = DibHeader(std::cin, std::nullopt);
+        }
+        ProfileScope profile("decode pixels");
+        ReadPixelMatrix(std::cin, region);
+    } else {
+        CheckInputFileExists(file_name);
+        uintmax_t file_size = std::filesystem::file_size(file_name);
+        if (MappedFile::IsSupported() && file_size >= MAPPING_THRESHOLD) {
+            std::shared_ptr<const MappedFile> file;
+            {
+                ProfileScope profile("parse header");
+                file = std::make_shared<const MappedFile>(file_name);
+                bmp_header_ = BmpHeader(file->GetData(), file_size);
+                dib_header_ = DibHeader(file->GetData() + BmpHeader::BMPHEADERSIZE, file_size);
+            }
+            ProfileScope profile("decode pixels");
+            MapPixelMatrix(std::move(file), region);
+            if (Profiler::IsEnabled()) {
+                TouchPages(*this);
+            }
+        } else {
+            std::ifstream file(file_name, std::ios_base::binary | std::ios_base::in);
+            {
+                ProfileScope profile("parse header");
+                bmp_header_ = BmpHeader(file, file_size);
+                dib_header_ = DibHeader(file, file_size);
+            }
+            ProfileScope profile("decode pixels");
+            ReadPixelMatrix(file, region);
+        }
+    }
+    InitHeaders(bmp_header_, dib_header_, GetWidth(), GetHeight());
 }
 
 void Bmp::CheckInputFileExists(std::filesystem::path file_name) {
@@ -33,66 +183,189 @@ void Bmp::CheckInputFileExists(std::filesystem::path file_name) {
 }
 
 Bmp::Bmp(Image image) : Image{std::move(image)} {
-    dib_header_.width_ = static_cast<int32_t>(GetWidth());
-    dib_header_.height_ = static_cast<int32_t>(GetHeight());
-    dib_header_.data_size_ = (dib_header_.width_ * 3 + dib_header_.width_ % 4) * dib_header_.height_;
-    bmp_header_.size_ = bmp_header_.BMPOFFSETDEFAULT + dib_header_.data_size_;
+    InitHeaders(bmp_header_, dib_header_, GetWidth(), GetHeight());
 }
 
-void Bmp::Save(std::filesystem::path file_name) {
-    std::ofstream file(file_name, std::ios_base::binary | std::ios_base::out);
-    bmp_header_.Write(file);
-    dib_header_.Write(file);
-    WritePixelMatrix(file);
+void Bmp::Save(std::filesystem::path file_name, uint16_t bits_per_pixel) {
+    ProfileScope profile("encode");
+    InitHeaders(bmp_header_, dib_header_, GetWidth(), GetHeight(), bits_per_pixel);
+    WriteFile(file_name, [this](std::ostream& file) {
+        bmp_header_.Write(file);
+        dib_header_.Write(file);
+        WritePalette(file, dib_header_.colors_);
+        WritePixelMatrix(file);
+    });
 }
 
-void Bmp::WritePixelMatrix(std::ofstream& file) {
-    for (size_t row = dib_header_.height_ - 1; ~row; --row) {
-        for (size_t col = 0; col < dib_header_.width_; ++col) {
-            const Pixel& pixel = GetPixel(row, col);
-            Write(file, static_cast<uint8_t>(pixel.blue_ * MAX_COLOR));
-            Write(file, static_cast<uint8_t>(pixel.green_ * MAX_COLOR));
-            Write(file, static_cast<uint8_t>(pixel.red_ * MAX_COLOR));
-        }
-        for (size_t k = 0; k < dib_header_.width_ % 4; ++k) {
-            Write(file, static_cast<uint8_t>(0));
+void Bmp::SaveMask(const Bitmask& mask, std::filesystem::path file_name, uint16_t bits_per_pixel) {
+    ProfileScope profile("encode");
+    BmpHeader bmp_header;
+    DibHeader dib_header;
+    InitHeaders(bmp_header, dib_header, mask.GetWidth(), mask.GetHeight(), bits_per_pixel);
+    WriteFile(file_name, [&](std::ostream& file) {
+        bmp_header.Write(file);
+        dib_header.Write(file);
+        WritePalette(file, dib_header.colors_);
+        // The rows of the mask are already laid out as 1-bit scanlines.
+        std::vector<char> scanline(::GetPaddedRowSize(mask.GetWidth(), bits_per_pixel), 0);
+        std::vector<Pixel> pixels(mask.GetWidth());
+        for (size_t row = mask.GetHeight() - 1; ~row; --row) {
+            if (bits_per_pixel == DibHeader::BITSPERPIXELMASK) {
+                file.write(reinterpret_cast<const char*>(mask.GetRow(row)),
+                           static_cast<std::streamsize>(mask.GetRowSize()));
+                continue;
+            }
+            for (size_t col = 0; col < mask.GetWidth(); ++col) {
+                uint8_t color = mask.Get(row, col) ? MAX_COLOR : 0;
+                pixels[col] = {color, color, color};
+            }
+            EncodeScanline(pixels.data(), mask.GetWidth(), bits_per_pixel, scanline.data());
+            file.write(scanline.data(), static_cast<std::streamsize>(scanline.size()));
         }
-    }
+    });
+}
+
+size_t Bmp::GetPaddedRowSize() const {
+    return ::GetPaddedRowSize(static_cast<size_t>(dib_header_.width_), dib_header_.bits_per_pixel_);
 }
 
-void Bmp::ReadPixelMatrix(std::ifstream& file) {
-    Resize(static_cast<size_t>(dib_header_.width_), static_cast<size_t>(dib_header_.height_));
+void Bmp::WritePixelMatrix(std::ostream& file) {
+    std::vector<char> scanline(GetPaddedRowSize(), 0);
     for (size_t row = dib_header_.height_ - 1; ~row; --row) {
-        for (size_t col = 0; col < dib_header_.width_; ++col) {
-            Pixel& pixel = GetPixel(row, col);
-            pixel.blue_ = static_cast<double>(Read<uint8_t>(file)) / MAX_COLOR;
-            pixel.green_ = static_cast<double>(Read<uint8_t>(file)) / MAX_COLOR;
-            pixel.red_ = static_cast<double>(Read<uint8_t>(file)) / MAX_COLOR;
-        }
-        for (size_t k = 0; k < dib_header_.width_ % 4; ++k) {
-            Read<uint8_t>(file);
-        }
+        EncodeScanline(GetRow(row), GetWidth(), dib_header_.bits_per_pixel_, scanline.data());
+        file.write(scanline.data(), static_cast<std::streamsize>(scanline.size()));
+    }
+}
+
+void Bmp::ReadPixelMatrix(std::istream& file, ImageSize region) {
+    region = ClampRegion(region, dib_header_);
+    Resize(region.width, region.height);
+    SkipInput(file, GetPaddedRowSize() * (dib_header_.height_ - region.height));
+    for (size_t row = region.height - 1; ~row; --row) {
+        ReadScanline(file, GetRow(row), region.width, GetPaddedRowSize());
     }
+    if (!file) {
+        throw std::invalid_argument("The loaded BMP-format image is damaged (truncated pixel data)");
+    }
+}
+
+void Bmp::MapPixelMatrix(std::shared_ptr<const MappedFile> file, ImageSize region) {
+    size_t width = static_cast<size_t>(dib_header_.width_);
+    size_t height = static_cast<size_t>(dib_header_.height_);
+    if (bmp_header_.offset_ + GetPaddedRowSize() * height > file->GetSize()) {
+        throw std::invalid_argument("The loaded BMP-format image is damaged (truncated pixel data)");
+    }
+    if (width == 0 || height == 0) {
+        return;
+    }
+    const char* top_row = file->GetData() + bmp_header_.offset_ + GetPaddedRowSize() * (height - 1);
+    std::shared_ptr<const std::byte> first_row(std::move(file), reinterpret_cast<const std::byte*>(top_row));
+    region = ClampRegion(region, dib_header_);
+    static_cast<Image&>(*this) = Image(std::move(first_row), -static_cast<ptrdiff_t>(GetPaddedRowSize()), width, height)
+                                     .GetView(0, 0, region.width, region.height);
 }
 
-Image Bmp::GetImage() {
+Image Bmp::GetImage() const& {
     return *this;
 }
 
-BmpHeader::BmpHeader(std::ifstream& file, std::filesystem::path file_name) {
+Image Bmp::GetImage() && {
+    return std::move(*this);
+}
+
+BmpReader::BmpReader(std::filesystem::path file_name, ImageSize region)
+    : input_(file_name == STANDARD_STREAM_NAME ? std::cin : static_cast<std::istream&>(file_)) {
+    ProfileScope profile("parse header");
+    std::optional<uintmax_t> file_size;
+    if (file_name != STANDARD_STREAM_NAME) {
+        if (!std::filesystem::exists(file_name)) {
+            throw std::invalid_argument("Invalid input file_name: such image doesn't exists");
+        }
+        file_size = std::filesystem::file_size(file_name);
+        file_.open(file_name, std::ios_base::binary | std::ios_base::in);
+    }
+    bmp_header_ = BmpHeader(input_, file_size);
+    dib_header_ = DibHeader(input_, file_size);
+    region_ = ClampRegion(region, dib_header_);
+    rows_left_ = region_.height;
+    SkipInput(input_, GetPaddedRowSize(static_cast<size_t>(dib_header_.width_)) *
+                          (dib_header_.height_ - region_.height));
+}
+
+size_t BmpReader::GetWidth() const {
+    return region_.width;
+}
+
+size_t BmpReader::GetHeight() const {
+    return region_.height;
+}
+
+size_t BmpReader::GetRowsLeft() const {
+    return rows_left_;
+}
+
+Image BmpReader::ReadStrip(size_t max_rows) {
+    ProfileScope profile("decode pixels");
+    size_t rows = std::min(max_rows, rows_left_);
+    Image strip(GetWidth(), rows);
+    for (size_t row = rows - 1; ~row; --row) {
+        ReadScanline(input_, strip.GetRow(row), GetWidth(), GetPaddedRowSize(static_cast<size_t>(dib_header_.width_)));
+    }
+    if (!input_) {
+        throw std::invalid_argument("The loaded BMP-format image is damaged (truncated pixel data)");
+    }
+    rows_left_ -= rows;
+    return strip;
+}
+
+BmpWriter::BmpWriter(std::filesystem::path file_name, size_t width, size_t height, uint16_t bits_per_pixel)
+    : output_(file_name == STANDARD_STREAM_NAME ? std::cout : static_cast<std::ostream&>(file_)),
+      scanline_(GetPaddedRowSize(width, bits_per_pixel), 0) {
+    ProfileScope profile("encode");
+    if (file_name != STANDARD_STREAM_NAME) {
+        file_.open(file_name, std::ios_base::binary | std::ios_base::out);
+    }
+    InitHeaders(bmp_header_, dib_header_, width, height, bits_per_pixel);
+    bmp_header_.Write(output_);
+    dib_header_.Write(output_);
+    WritePalette(output_, dib_header_.colors_);
+}
+
+void BmpWriter::WriteStrip(const Image& strip) {
+    ProfileScope profile("encode");
+    for (size_t row = strip.GetHeight() - 1; ~row; --row) {
+        EncodeScanline(strip.GetRow(row), strip.GetWidth(), dib_header_.bits_per_pixel_, scanline_.data());
+        output_.write(scanline_.data(), static_cast<std::streamsize>(scanline_.size()));
+    }
+    output_.flush();
+}
+
+BmpHeader::BmpHeader(std::istream& file, std::optional<uintmax_t> file_size) {
     Load(file);
-    Check(file_name);
+    Check(file_size);
+}
+
+BmpHeader::BmpHeader(const char* data, std::optional<uintmax_t> file_size) {
+    Load(data);
+    Check(file_size);
 }
 
-void BmpHeader::Load(std::ifstream& file) {
-    file.read(id_field_, sizeof(id_field_));
-    size_ = Read<decltype(size_)>(file);
-    app_specific1_ = Read<decltype(app_specific1_)>(file);
-    app_specific2_ = Read<decltype(app_specific2_)>(file);
-    offset_ = Read<decltype(offset_)>(file);
+void BmpHeader::Load(std::istream& file) {
+    char data[BMPHEADERSIZE] = {};
+    file.read(data, BMPHEADERSIZE);
+    Load(data);
 }
 
-void BmpHeader::Write(std::ofstream& file) const {
+void BmpHeader::Load(const char* data) {
+    id_field_[0] = Read<char>(data);
+    id_field_[1] = Read<char>(data);
+    size_ = Read<decltype(size_)>(data);
+    app_specific1_ = Read<decltype(app_specific1_)>(data);
+    app_specific2_ = Read<decltype(app_specific2_)>(data);
+    offset_ = Read<decltype(offset_)>(data);
+}
+
+void BmpHeader::Write(std::ostream& file) const {
     ::Write(file, 'B');
     ::Write(file, 'M');
     ::Write(file, size_);
@@ -101,11 +374,11 @@ void BmpHeader::Write(std::ofstream& file) const {
     ::Write(file, offset_);
 }
 
-void BmpHeader::Check(std::filesystem::path file_name) const {
+void BmpHeader::Check(std::optional<uintmax_t> file_size) const {
     if (id_field_[0] != 'B' || id_field_[1] != 'M') {
         throw std::invalid_argument("The loaded BMP-format image is damaged (invalied ID field)");
     }
-    if (size_ != file_size(file_name)) {
+    if (file_size && size_ != *file_size) {
         throw std::invalid_argument("The loaded BMP-format image is damaged (invalied size of the file field)");
     }
     if (offset_ != BMPOFFSETDEFAULT) {
@@ -113,26 +386,50 @@ void BmpHeader::Check(std::filesystem::path file_name) const {
     }
 }
 
-DibHeader::DibHeader(std::ifstream& file, std::filesystem::path file_name) {
+DibHeader::DibHeader(std::istream& file, std::optional<uintmax_t> file_size) {
     Load(file);
-    Check(file_name);
+    Check(file_size);
+}
+
+DibHeader::DibHeader(const char* data, std::optional<uintmax_t> file_size) {
+    Load(data);
+    Check(file_size);
+}
+
+uint32_t DibHeader::GetPaletteSize(uint16_t bits_per_pixel) {
+    if (bits_per_pixel == BITSPERPIXELDEFAULT) {
+        return 0;
+    }
+    if (bits_per_pixel == BITSPERPIXELGRAY) {
+        return MAX_COLOR + 1;
+    }
+    if (bits_per_pixel == BITSPERPIXELMASK) {
+        return 2;
+    }
+    throw std::invalid_argument("BMP images are written with 1, 8 or 24 bits per pixel");
+}
+
+void DibHeader::Load(std::istream& file) {
+    char data[DIBHEADERSIZEDEFAULT] = {};
+    file.read(data, DIBHEADERSIZEDEFAULT);
+    Load(data);
 }
 
-void DibHeader::Load(std::ifstream& file) {
-    dib_size_ = Read<decltype(dib_size_)>(file);
-    width_ = Read<decltype(width_)>(file);
-    height_ = Read<decltype(height_)>(file);
-    color_panels_ = Read<decltype(color_panels_)>(file);
-    bits_per_pixel_ = Read<decltype(bits_per_pixel_)>(file);
-    bi_rgb_ = Read<decltype(bi_rgb_)>(file);
-    data_size_ = Read<decltype(data_size_)>(file);
-    resolution_horizontal_ = Read<decltype(resolution_horizontal_)>(file);
-    resolution_vertical_ = Read<decltype(resolution_vertical_)>(file);
-    colors_ = Read<decltype(colors_)>(file);
-    important_colors_ = Read<decltype(important_colors_)>(file);
+void DibHeader::Load(const char* data) {
+    dib_size_ = Read<decltype(dib_size_)>(data);
+    width_ = Read<decltype(width_)>(data);
+    height_ = Read<decltype(height_)>(data);
+    color_panels_ = Read<decltype(color_panels_)>(data);
+    bits_per_pixel_ = Read<decltype(bits_per_pixel_)>(data);
+    bi_rgb_ = Read<decltype(bi_rgb_)>(data);
+    data_size_ = Read<decltype(data_size_)>(data);
+    resolution_horizontal_ = Read<decltype(resolution_horizontal_)>(data);
+    resolution_vertical_ = Read<decltype(resolution_vertical_)>(data);
+    colors_ = Read<decltype(colors_)>(data);
+    important_colors_ = Read<decltype(important_colors_)>(data);
 }
 
-void DibHeader::Write(std::ofstream& file) const {
+void DibHeader::Write(std::ostream& file) const {
     ::Write(file, dib_size_);
     ::Write(file, width_);
     ::Write(file, height_);
@@ -146,7 +443,7 @@ void DibHeader::Write(std::ofstream& file) const {
     ::Write(file, important_colors_);
 }
 
-void DibHeader::Check(std::filesystem::path file_name) const {
+void DibHeader::Check(std::optional<uintmax_t> file_size) const {
     if (dib_size_ != DIBHEADERSIZEDEFAULT) {
         throw std::invalid_argument("The loaded BMP-format image is damaged (invalied DIB Header size field)");
     }
@@ -159,7 +456,7 @@ void DibHeader::Check(std::filesystem::path file_name) const {
     if (bi_rgb_ != BIRGBDEFAULT) {
         throw std::invalid_argument("The loaded BMP-format image is damaged (invalid BI RGB field)");
     }
-    if (data_size_ != file_size(file_name) - BMPOFFSETDEFAULT && data_size_ != 0) {
+    if (file_size && data_size_ != *file_size - BMPOFFSETDEFAULT && data_size_ != 0) {
         throw std::invalid_argument(
             "The loaded BMP-format image is damaged (invalid size of the raw bitmap data field)");
     }
@@ -1,19 +1,32 @@
 #pragma once
 
+#include "Bitmask.h"
 #include "image.h"
+#include "MappedFile.h"
 
 #include <filesystem>
 #include <fstream>
+#include <istream>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string_view>
+#include <vector>
 
-const int MAX_COLOR = 255;
+// As a file name: stdin for an input and stdout for an output.
+constexpr std::string_view STANDARD_STREAM_NAME = "-";
 
 struct BmpHeader {
 public:
     static const int BMPOFFSETDEFAULT = 54;
+    static const size_t BMPHEADERSIZE = 14;
 
     BmpHeader() = default;
 
-    BmpHeader(std::ifstream& file, std::filesystem::path file_name);
+    // The sizes in the header are checked against the file size when it is known, i.e. unless reading from a pipe.
+    BmpHeader(std::istream& file, std::optional<uintmax_t> file_size);
+
+    BmpHeader(const char* data, std::optional<uintmax_t> file_size);
 
     char id_field_[2];
     uint32_t size_ = 0;
@@ -21,22 +34,28 @@ public:
     uint16_t app_specific2_ = 0;
     uint32_t offset_ = BMPOFFSETDEFAULT;
 
-    void Load(std::ifstream& file);
+    void Load(std::istream& file);
+
+    void Load(const char* data);
 
-    void Check(std::filesystem::path file_name) const;
+    void Check(std::optional<uintmax_t> file_size) const;
 
-    void Write(std::ofstream& file) const;
+    void Write(std::ostream& file) const;
 };
 
 struct DibHeader {
 
     DibHeader() = default;
 
-    DibHeader(std::ifstream& file, std::filesystem::path file_name);
+    DibHeader(std::istream& file, std::optional<uintmax_t> file_size);
+
+    DibHeader(const char* data, std::optional<uintmax_t> file_size);
 
     static const uint32_t DIBHEADERSIZEDEFAULT = 40;
     static const uint32_t COLORPANELSDEFAULT = 1;
     static const uint16_t BITSPERPIXELDEFAULT = 24;
+    static const uint16_t BITSPERPIXELGRAY = 8;
+    static const uint16_t BITSPERPIXELMASK = 1;
     static const uint32_t BIRGBDEFAULT = 0;
     static const int BMPOFFSETDEFAULT = 54;
     static const uint32_t COLORSDEFAULT = 0;
@@ -54,30 +73,88 @@ struct DibHeader {
     uint32_t colors_ = COLORSDEFAULT;
     uint32_t important_colors_ = IMPORTANTCOLORSDEFAULT;
 
-    void Load(std::ifstream& file);
+    // Returns the number of palette entries that images with the given bits per pixel are written with.
+    static uint32_t GetPaletteSize(uint16_t bits_per_pixel);
+
+    void Load(std::istream& file);
 
-    void Check(std::filesystem::path file_name) const;
+    void Load(const char* data);
 
-    void Write(std::ofstream& file) const;
+    void Check(std::optional<uintmax_t> file_size) const;
+
+    void Write(std::ostream& file) const;
 };
 
 class Bmp : public Image {
 public:
+    static const uintmax_t MAPPING_THRESHOLD = 1 << 20;
+
     explicit Bmp(std::filesystem::path file_name);
 
+    // Decodes only the top left region of the image, seeking past the rows and columns outside it.
+    Bmp(std::filesystem::path file_name, ImageSize region);
+
     explicit Bmp(Image image);
 
     void CheckInputFileExists(std::filesystem::path file_name);
 
-    void Save(std::filesystem::path file_name);
+    // Writes 24-bit pixels, or indices into a palette: 8-bit ones into a ramp of grays for gray images and 1-bit ones
+    // into black and white for black and white images.
+    void Save(std::filesystem::path file_name, uint16_t bits_per_pixel = DibHeader::BITSPERPIXELDEFAULT);
+
+    static void SaveMask(const Bitmask& mask, std::filesystem::path file_name,
+                         uint16_t bits_per_pixel = DibHeader::BITSPERPIXELMASK);
 
-    void WritePixelMatrix(std::ofstream& file);
+    void WritePixelMatrix(std::ostream& file);
 
-    Image GetImage();
+    Image GetImage() const&;
+
+    Image GetImage() &&;
 
 private:
     BmpHeader bmp_header_;
     DibHeader dib_header_;
 
-    void ReadPixelMatrix(std::ifstream& file);
-};
\ No newline at end of file
+    size_t GetPaddedRowSize() const;
+
+    void ReadPixelMatrix(std::istream& file, ImageSize region);
+
+    void MapPixelMatrix(std::shared_ptr<const MappedFile> file, ImageSize region);
+};
+
+class BmpReader {
+public:
+    explicit BmpReader(std::filesystem::path file_name, ImageSize region = UNBOUNDED_SIZE);
+
+    size_t GetWidth() const;
+
+    size_t GetHeight() const;
+
+    size_t GetRowsLeft() const;
+
+    // Strips are decoded in file order, i.e. from the bottom of the region up.
+    Image ReadStrip(size_t max_rows);
+
+private:
+    std::ifstream file_;
+    std::istream& input_;
+    BmpHeader bmp_header_;
+    DibHeader dib_header_;
+    ImageSize region_;
+    size_t rows_left_ = 0;
+};
+
+class BmpWriter {
+public:
+    BmpWriter(std::filesystem::path file_name, size_t width, size_t height,
+              uint16_t bits_per_pixel = DibHeader::BITSPERPIXELDEFAULT);
+
+    void WriteStrip(const Image& strip);
+
+private:
+    std::ofstream file_;
+    std::ostream& output_;
+    BmpHeader bmp_header_;
+    DibHeader dib_header_;
+    std::vector<char> scanline_;
+};
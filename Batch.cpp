@@ -0,0 +1,81 @@
+#include "Batch.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+std::vector<BatchJob> ReadManifest(const std::filesystem::path& manifest) {
+    std::ifstream file(manifest);
+    if (!file) {
+        throw std::invalid_argument("Could not open the batch manifest " + manifest.string());
+    }
+    std::vector<BatchJob> jobs;
+    std::string line;
+    for (size_t line_number = 1; std::getline(file, line); ++line_number) {
+        std::istringstream fields(line);
+        BatchJob job;
+        if (!(fields >> job.input)) {
+            continue;
+        }
+        std::string extra;
+        if (!(fields >> job.output) || fields >> extra) {
+            throw std::invalid_argument("Line " + std::to_string(line_number) +
+                                        " of the batch manifest must name an input and an output file");
+        }
+        jobs.push_back(std::move(job));
+    }
+    return jobs;
+}
+
+std::vector<BatchJob> ListBatchDirectory(const std::filesystem::path& input_dir,
+                                         const std::filesystem::path& output_dir) {
+    if (!std::filesystem::is_directory(input_dir)) {
+        throw std::invalid_argument("Invalid input directory: " + input_dir.string());
+    }
+    std::filesystem::create_directories(output_dir);
+    std::vector<BatchJob> jobs;
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(input_dir)) {
+        std::string extension = entry.path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+                       [](unsigned char symbol) { return std::tolower(symbol); });
+        if (entry.is_regular_file() && extension == ".bmp") {
+            jobs.push_back({entry.path(), output_dir / entry.path().filename()});
+        }
+    }
+    std::sort(jobs.begin(), jobs.end(),
+              [](const BatchJob& lhs, const BatchJob& rhs) { return lhs.input < rhs.input; });
+    return jobs;
+}
+
+size_t RunBatch(const std::vector<BatchJob>& jobs, const std::vector<std::unique_ptr<Filter>>& filters,
+                const ProcessingOptions& options) {
+    std::atomic<size_t> next_job = 0;
+    std::atomic<size_t> failed_jobs = 0;
+    std::mutex report_mutex;
+    // One band per thread, each taking the next job as soon as it is done with the last: one image is decoded
+    // while others are being filtered, and uneven image sizes do not leave threads idle.
+    ThreadPool& pool = ThreadPool::GetDefault();
+    pool.ParallelFor(std::min(jobs.size(), pool.GetThreadCount()), [&](size_t, size_t) {
+        for (size_t job = next_job++; job < jobs.size(); job = next_job++) {
+            try {
+                ProcessImage(jobs[job].input, jobs[job].output, filters, options);
+            } catch (const std::exception& error) {
+                ++failed_jobs;
+                std::lock_guard<std::mutex> lock(report_mutex);
+                std::cerr << jobs[job].input.string() << ": " << error.what() << std::endl;
+            }
+        }
+    });
+    if (failed_jobs != 0) {
+        std::cerr << failed_jobs << " of " << jobs.size() << " images failed" << std::endl;
+    }
+    return failed_jobs;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Filter.h"
+#include "Pipeline.h"
+
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+struct BatchJob {
+    std::filesystem::path input;
+    std::filesystem::path output;
+};
+
+// Reads one job per line: the input and the output path separated by whitespace; paths with spaces are quoted.
+std::vector<BatchJob> ReadManifest(const std::filesystem::path& manifest);
+
+// Makes a job for every .bmp file in the input directory, writing to a file of the same name in the output one.
+std::vector<BatchJob> ListBatchDirectory(const std::filesystem::path& input_dir,
+                                         const std::filesystem::path& output_dir);
+
+// Runs every job through the same chain, several images at a time. A failed job is reported to stderr and does not
+// stop the others; returns the number of failed jobs.
+size_t RunBatch(const std::vector<BatchJob>& jobs, const std::vector<std::unique_ptr<Filter>>& filters,
+                const ProcessingOptions& options);
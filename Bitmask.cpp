@@ -0,0 +1,44 @@
+#include "Bitmask.h"
+
+namespace {
+
+const size_t ROW_ALIGNMENT = 4;
+const size_t BITS_PER_BYTE = 8;
+const uint8_t FIRST_BIT = 0x80;
+
+}  // namespace
+
+Bitmask::Bitmask(size_t width, size_t height)
+    : width_(width),
+      height_(height),
+      row_size_((width + ROW_ALIGNMENT * BITS_PER_BYTE - 1) / (ROW_ALIGNMENT * BITS_PER_BYTE) * ROW_ALIGNMENT) {
+    bits_.resize(row_size_ * height);
+}
+
+size_t Bitmask::GetWidth() const {
+    return width_;
+}
+
+size_t Bitmask::GetHeight() const {
+    return height_;
+}
+
+size_t Bitmask::GetRowSize() const {
+    return row_size_;
+}
+
+uint8_t* Bitmask::GetRow(size_t row) {
+    return bits_.data() + row * row_size_;
+}
+
+const uint8_t* Bitmask::GetRow(size_t row) const {
+    return bits_.data() + row * row_size_;
+}
+
+bool Bitmask::Get(size_t row, size_t col) const {
+    return (GetRow(row)[col / BITS_PER_BYTE] & (FIRST_BIT >> (col % BITS_PER_BYTE))) != 0;
+}
+
+void Bitmask::Set(size_t row, size_t col) {
+    GetRow(row)[col / BITS_PER_BYTE] |= FIRST_BIT >> (col % BITS_PER_BYTE);
+}
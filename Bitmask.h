@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A black and white image with one bit per pixel, set for white. Rows are packed from the most significant bit of
+// their first byte on and padded to 4 bytes, like the scanlines of a 1-bit BMP.
+class Bitmask {
+public:
+    Bitmask() = default;
+
+    // All pixels start black.
+    Bitmask(size_t width, size_t height);
+
+    size_t GetWidth() const;
+
+    size_t GetHeight() const;
+
+    size_t GetRowSize() const;
+
+    uint8_t* GetRow(size_t row);
+
+    const uint8_t* GetRow(size_t row) const;
+
+    bool Get(size_t row, size_t col) const;
+
+    void Set(size_t row, size_t col);
+
+private:
+    std::vector<uint8_t> bits_;
+    size_t width_ = 0;
+    size_t height_ = 0;
+    size_t row_size_ = 0;
+};
@@ -0,0 +1,103 @@
+#include "BufferPool.h"
+
+#include <algorithm>
+#include <bit>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
+
+double BufferPoolStats::GetHitRate() const {
+    return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses);
+}
+
+BufferPool::~BufferPool() {
+    Clear();
+}
+
+size_t BufferPool::GetClassSize(size_t bytes) {
+    if (bytes <= MIN_CLASS_SIZE) {
+        return MIN_CLASS_SIZE;
+    }
+    // Four classes per power of two: 4, 5, 6 and 7 times a quarter of it.
+    size_t step = std::max(MIN_CLASS_SIZE, std::bit_floor(bytes) / 4);
+    return (bytes + step - 1) / step * step;
+}
+
+std::shared_ptr<std::byte> BufferPool::Acquire(size_t bytes) {
+    size_t size = GetClassSize(bytes);
+    Buffer buffer;
+    bool huge_pages = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        huge_pages = huge_pages_;
+        auto same_class = free_buffers_.find(size);
+        if (same_class != free_buffers_.end() && !same_class->second.empty()) {
+            buffer = same_class->second.back();
+            same_class->second.pop_back();
+            stats_.cached_bytes -= size;
+            ++stats_.hits;
+        } else {
+            // Lets the cached buffers go before allocating, like BasicImage::Reset does.
+            ClearLocked();
+            ++stats_.misses;
+        }
+    }
+    if (buffer.data == nullptr) {
+        buffer.huge = huge_pages && size >= HUGE_PAGE_SIZE;
+        if (buffer.huge) {
+            buffer.data = new (std::align_val_t{HUGE_PAGE_SIZE}) std::byte[size];
+#ifdef MADV_HUGEPAGE
+            madvise(buffer.data, size, MADV_HUGEPAGE);
+#endif
+        } else {
+            buffer.data = new (std::align_val_t{MIN_CLASS_SIZE}) std::byte[size];
+        }
+    }
+    return std::shared_ptr<std::byte>(buffer.data, [this, buffer, size](std::byte*) { Release(buffer, size); });
+}
+
+void BufferPool::SetHugePages(bool enabled) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    huge_pages_ = enabled;
+}
+
+BufferPoolStats BufferPool::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void BufferPool::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ClearLocked();
+}
+
+BufferPool& BufferPool::GetDefault() {
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+
+void BufferPool::Release(Buffer buffer, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_buffers_[size].push_back(buffer);
+    stats_.cached_bytes += size;
+}
+
+void BufferPool::ClearLocked() {
+    for (auto& [size, buffers] : free_buffers_) {
+        for (Buffer buffer : buffers) {
+            Free(buffer);
+        }
+    }
+    free_buffers_.clear();
+    stats_.cached_bytes = 0;
+}
+
+void BufferPool::Free(Buffer buffer) {
+    if (buffer.huge) {
+        ::operator delete[](buffer.data, std::align_val_t{HUGE_PAGE_SIZE});
+    } else {
+        ::operator delete[](buffer.data, std::align_val_t{MIN_CLASS_SIZE});
+    }
+}
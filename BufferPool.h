@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct BufferPoolStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t cached_bytes = 0;
+
+    double GetHitRate() const;
+};
+
+// Keeps the pixel buffers of destroyed images for the next image of a similar size, so that a chain and a batch of
+// similar images stop paying for fresh allocations and the page faults on them. Sizes are rounded up to classes at
+// most a quarter apart. Cached buffers are handed back to the system whenever a size class runs dry, so that the
+// cache never adds to the peak memory of a job. A pool must outlive the buffers it hands out.
+class BufferPool {
+public:
+    static const size_t MIN_CLASS_SIZE = 64;
+    static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+    BufferPool() = default;
+
+    BufferPool(const BufferPool&) = delete;
+
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    ~BufferPool();
+
+    // Returns the size of the buffers that requests of the given size get.
+    static size_t GetClassSize(size_t bytes);
+
+    // Returns a buffer of GetClassSize(bytes) bytes, aligned to at least 64 bytes, that goes back to the pool when the
+    // last pointer to it is released. Its contents are unspecified.
+    std::shared_ptr<std::byte> Acquire(size_t bytes);
+
+    // Backs buffers of a huge page or more with transparent huge pages where the system supports them.
+    void SetHugePages(bool enabled);
+
+    BufferPoolStats GetStats() const;
+
+    // Hands every cached buffer back to the system.
+    void Clear();
+
+    // The pool of all images; it is never destroyed, as images may outlive any other object.
+    static BufferPool& GetDefault();
+
+private:
+    struct Buffer {
+        std::byte* data = nullptr;
+        bool huge = false;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<size_t, std::vector<Buffer>> free_buffers_;
+    BufferPoolStats stats_;
+    bool huge_pages_ = false;
+
+    void Release(Buffer buffer, size_t size);
+
+    void ClearLocked();
+
+    static void Free(Buffer buffer);
+};
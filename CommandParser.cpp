@@ -1,29 +1,110 @@
 #include "CommandParser.h"
 
 #include <stdexcept>
+#include <string_view>
 
 CommandParser::CommandParser(int argc, char** argv) {
-    CheckArgc(argc);
     filters_data_ = ParseArgs(argc, argv);
 }
 
-void CommandParser::CheckArgc(int argc) {
-    if (argc == 2) {
+CommandArgs CommandParser::ParseArgs(int argc, char** argv) const {
+    CommandArgs result;
+    std::vector<char*> args = ParseOptions(argc, argv, result);
+    if (result.profiling && (result.serving || !result.manifest_filename.empty() || !result.input_dir.empty())) {
+        throw std::invalid_argument("Option --profile profiles a single image, not batch or daemon mode");
+    }
+    if (result.serving) {
+        if (args.size() > 1) {
+            throw std::invalid_argument("Daemon mode takes the images and filters in its requests, not as arguments");
+        }
+        return result;
+    }
+    if (result.input_dir.empty() != result.output_dir.empty()) {
+        throw std::invalid_argument("Options --input-dir and --output-dir must be given together");
+    }
+    if (!result.manifest_filename.empty() || !result.input_dir.empty()) {
+        if (!result.manifest_filename.empty() && !result.input_dir.empty()) {
+            throw std::invalid_argument("Batch mode takes either a manifest or an input and an output directory");
+        }
+        result.filters = ParseFilters(static_cast<int>(args.size()), args.data(), 1);
+        return result;
+    }
+    if (args.size() == 2) {
         throw std::invalid_argument("Photo editor takes at least 2 arguments: input_filename and output_filename");
     }
+    if (args.size() < 3) {
+        return result;
+    }
+    result.input_filename = args[1];
+    result.output_filename = args[2];
+    result.filters = ParseFilters(static_cast<int>(args.size()), args.data());
+    return result;
 }
 
-CommandArgs CommandParser::ParseArgs(int argc, char** argv) const {
-    CommandArgs result;
-    result.input_filename = argv[1];
-    result.output_filename = argv[2];
-    result.filters = ParseFilters(argc, argv);
-    return result;
+std::vector<char*> CommandParser::ParseOptions(int argc, char** argv, CommandArgs& result) const {
+    std::vector<char*> args;
+    for (int i = 0; i < argc; ++i) {
+        std::string_view arg(argv[i]);
+        if (i == 0 || !arg.starts_with("--")) {
+            args.push_back(argv[i]);
+        } else if (arg == "--stream") {
+            result.streaming = true;
+        } else if (arg == "--strip-height") {
+            result.streaming = true;
+            result.strip_height = ParseCount(arg, i + 1 < argc ? argv[++i] : nullptr);
+        } else if (arg == "--bits-per-pixel") {
+            result.bits_per_pixel = ParseCount(arg, i + 1 < argc ? argv[++i] : nullptr);
+            if (result.bits_per_pixel != 1 && result.bits_per_pixel != 8 && result.bits_per_pixel != 24) {
+                throw std::invalid_argument("Option --bits-per-pixel takes 1, 8 or 24");
+            }
+        } else if (arg == "--threads") {
+            result.threads = ParseCount(arg, i + 1 < argc ? argv[++i] : nullptr);
+        } else if (arg == "--manifest") {
+            result.manifest_filename = ParsePath(arg, i + 1 < argc ? argv[++i] : nullptr);
+        } else if (arg == "--input-dir") {
+            result.input_dir = ParsePath(arg, i + 1 < argc ? argv[++i] : nullptr);
+        } else if (arg == "--output-dir") {
+            result.output_dir = ParsePath(arg, i + 1 < argc ? argv[++i] : nullptr);
+        } else if (arg == "--serve") {
+            result.serving = true;
+        } else if (arg == "--huge-pages") {
+            result.huge_pages = true;
+        } else if (arg == "--profile") {
+            result.profiling = true;
+        } else if (arg == "--profile-json") {
+            result.profiling = true;
+            result.profile_json = true;
+        } else if (arg == "--socket") {
+            result.serving = true;
+            result.socket_path = ParsePath(arg, i + 1 < argc ? argv[++i] : nullptr);
+        } else {
+            throw std::invalid_argument("Unknown option " + std::string(arg));
+        }
+    }
+    return args;
+}
+
+size_t CommandParser::ParseCount(std::string_view option, const char* value) const {
+    if (value == nullptr) {
+        throw std::invalid_argument("Option " + std::string(option) + " takes a positive integer value");
+    }
+    int count = std::stoi(value);
+    if (count <= 0) {
+        throw std::invalid_argument("Option " + std::string(option) + " takes a positive integer value");
+    }
+    return static_cast<size_t>(count);
+}
+
+std::string CommandParser::ParsePath(std::string_view option, const char* value) const {
+    if (value == nullptr || *value == '\0') {
+        throw std::invalid_argument("Option " + std::string(option) + " takes a path");
+    }
+    return value;
 }
 
-std::vector<FilterArgs> CommandParser::ParseFilters(int argc, char** args) const {
+std::vector<FilterArgs> CommandParser::ParseFilters(int argc, char** args, int first_filter) const {
     std::vector<FilterArgs> result;
-    for (size_t i = 3; i < argc; ++i) {
+    for (int i = first_filter; i < argc; ++i) {
         if (args[i][0] == '-') {
             FilterArgs filter_desc;
             filter_desc.filter_name = std::string_view(args[i] + 1);
@@ -41,4 +122,4 @@ std::vector<FilterArgs> CommandParser::ParseFilters(int argc, char** args) const
 
 CommandArgs& CommandParser::GetFiltersData() {
     return filters_data_;
-}
\ No newline at end of file
+}
@@ -7,20 +7,40 @@ struct CommandArgs {
     std::string input_filename;
     std::string output_filename;
     std::vector<FilterArgs> filters;
+    bool streaming = false;
+    size_t strip_height = 0;
+    size_t bits_per_pixel = 0;
+    size_t threads = 0;
+    std::string manifest_filename;
+    std::string input_dir;
+    std::string output_dir;
+    bool serving = false;
+    std::string socket_path;
+    bool profiling = false;
+    bool profile_json = false;
+    bool huge_pages = false;
 };
 
 class CommandParser {
 public:
+    static const int FIRST_FILTER_ARG = 3;
+
     CommandParser(int argc, char** argv);
 
     CommandArgs ParseArgs(int argc, char** argv) const;
 
-    std::vector<FilterArgs> ParseFilters(int argc, char** args) const;
+    // Filters start after the program name, the input and the output file, or right after the program name in batch
+    // mode.
+    std::vector<FilterArgs> ParseFilters(int argc, char** args, int first_filter = FIRST_FILTER_ARG) const;
 
     CommandArgs& GetFiltersData();
 
 private:
     CommandArgs filters_data_;
 
-    void CheckArgc(int argc);
-};
\ No newline at end of file
+    std::vector<char*> ParseOptions(int argc, char** argv, CommandArgs& result) const;
+
+    size_t ParseCount(std::string_view option, const char* value) const;
+
+    std::string ParsePath(std::string_view option, const char* value) const;
+};
@@ -0,0 +1,491 @@
+#include "Convolution.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define IMAGE_PROCESSOR_X86_SIMD 1
+#endif
+
+namespace {
+
+const size_t CHANNELS = 3;
+
+static_assert(sizeof(Pixel) == CHANNELS * sizeof(uint8_t) && sizeof(FloatPixel) == CHANNELS * sizeof(float));
+
+// Samples are addressed as a flat BGR array: the horizontal neighbours of a sample are CHANNELS apart.
+void ConvolveSamplesInteger(const uint8_t* const rows[3], uint8_t* dst, size_t begin, size_t end,
+                            const int16_t weights[3][3]) {
+    for (size_t s = begin; s < end; ++s) {
+        int sum = 0;
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                sum += weights[i][j] * rows[i][s + j * CHANNELS - CHANNELS];
+            }
+        }
+        dst[s] = static_cast<uint8_t>(std::clamp(sum, 0, MAX_COLOR));
+    }
+}
+
+template <typename T>
+void ConvolveSamplesUnit(const T* const rows[3], T* dst, size_t begin, size_t end, const double weights[3][3]) {
+    for (size_t s = begin; s < end; ++s) {
+        double sum = 0;
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                sum += SampleTraits<T>::ToUnit(rows[i][s + j * CHANNELS - CHANNELS]) * weights[i][j];
+            }
+        }
+        dst[s] = SampleTraits<T>::FromUnit(std::clamp(sum, 0.0, 1.0));
+    }
+}
+
+#ifdef IMAGE_PROCESSOR_X86_SIMD
+
+__attribute__((target("avx2"))) size_t ConvolveSamplesIntegerAvx2(const uint8_t* const rows[3], uint8_t* dst,
+                                                                   size_t begin, size_t end,
+                                                                   const int16_t weights[3][3]) {
+    const size_t lanes = 16;
+    size_t s = begin;
+    for (; s + lanes <= end; s += lanes) {
+        __m256i sum = _mm256_setzero_si256();
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                if (weights[i][j] == 0) {
+                    continue;
+                }
+                const uint8_t* src = rows[i] + s + j * CHANNELS - CHANNELS;
+                __m256i samples = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+                sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(samples, _mm256_set1_epi16(weights[i][j])));
+            }
+        }
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(sum, sum), 0xD8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + s), _mm256_castsi256_si128(packed));
+    }
+    return s;
+}
+
+__attribute__((target("sse4.1"))) size_t ConvolveSamplesIntegerSse41(const uint8_t* const rows[3], uint8_t* dst,
+                                                                     size_t begin, size_t end,
+                                                                     const int16_t weights[3][3]) {
+    const size_t lanes = 8;
+    size_t s = begin;
+    for (; s + lanes <= end; s += lanes) {
+        __m128i sum = _mm_setzero_si128();
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                if (weights[i][j] == 0) {
+                    continue;
+                }
+                const uint8_t* src = rows[i] + s + j * CHANNELS - CHANNELS;
+                __m128i samples = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)));
+                sum = _mm_add_epi16(sum, _mm_mullo_epi16(samples, _mm_set1_epi16(weights[i][j])));
+            }
+        }
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + s), _mm_packus_epi16(sum, sum));
+    }
+    return s;
+}
+
+__attribute__((target("avx2"))) size_t ConvolveSamplesUnitAvx2(const float* const rows[3], float* dst, size_t begin,
+                                                                size_t end, const double weights[3][3]) {
+    const size_t lanes = 4;
+    size_t s = begin;
+    for (; s + lanes <= end; s += lanes) {
+        __m256d sum = _mm256_setzero_pd();
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                if (weights[i][j] == 0) {
+                    continue;
+                }
+                __m256d samples = _mm256_cvtps_pd(_mm_loadu_ps(rows[i] + s + j * CHANNELS - CHANNELS));
+                sum = _mm256_add_pd(sum, _mm256_mul_pd(samples, _mm256_set1_pd(weights[i][j])));
+            }
+        }
+        sum = _mm256_min_pd(_mm256_max_pd(sum, _mm256_setzero_pd()), _mm256_set1_pd(1.0));
+        _mm_storeu_ps(dst + s, _mm256_cvtpd_ps(sum));
+    }
+    return s;
+}
+
+__attribute__((target("sse4.1"))) size_t ConvolveSamplesUnitSse41(const float* const rows[3], float* dst,
+                                                                  size_t begin, size_t end,
+                                                                  const double weights[3][3]) {
+    const size_t lanes = 2;
+    size_t s = begin;
+    for (; s + lanes <= end; s += lanes) {
+        __m128d sum = _mm_setzero_pd();
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                if (weights[i][j] == 0) {
+                    continue;
+                }
+                const float* src = rows[i] + s + j * CHANNELS - CHANNELS;
+                __m128d samples = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src))));
+                sum = _mm_add_pd(sum, _mm_mul_pd(samples, _mm_set1_pd(weights[i][j])));
+            }
+        }
+        sum = _mm_min_pd(_mm_max_pd(sum, _mm_setzero_pd()), _mm_set1_pd(1.0));
+        _mm_storel_pi(reinterpret_cast<__m64*>(dst + s), _mm_cvtpd_ps(sum));
+    }
+    return s;
+}
+
+#endif
+
+}  // namespace
+
+SimdLevel DetectSimdLevel() {
+#ifdef IMAGE_PROCESSOR_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SimdLevel::SSE41;
+    }
+#endif
+    return SimdLevel::SCALAR;
+}
+
+Convolution3x3::Convolution3x3(const FilterMatrix& matrix, SimdLevel simd_level) : simd_level_(simd_level) {
+    if (matrix.size() != 3) {
+        throw std::invalid_argument("Convolution3x3 takes a 3x3 filter matrix");
+    }
+    int weight_sum = 0;
+    for (size_t i = 0; i < 3; ++i) {
+        if (matrix[i].size() != 3) {
+            throw std::invalid_argument("Convolution3x3 takes a 3x3 filter matrix");
+        }
+        for (size_t j = 0; j < 3; ++j) {
+            weights_[i][j] = matrix[i][j];
+            if (matrix[i][j] != std::round(matrix[i][j]) || std::abs(matrix[i][j]) > MAX_INTEGER_WEIGHT_SUM) {
+                has_integer_weights_ = false;
+                continue;
+            }
+            integer_weights_[i][j] = static_cast<int16_t>(matrix[i][j]);
+            weight_sum += std::abs(integer_weights_[i][j]);
+        }
+    }
+    if (weight_sum > MAX_INTEGER_WEIGHT_SUM) {
+        has_integer_weights_ = false;
+    }
+#ifndef IMAGE_PROCESSOR_X86_SIMD
+    simd_level_ = SimdLevel::SCALAR;
+#endif
+}
+
+SimdLevel Convolution3x3::GetSimdLevel() const {
+    return simd_level_;
+}
+
+void Convolution3x3::ConvolveInterior(const Pixel* const rows[3], Pixel* dst, size_t width) const {
+    if (width < 3) {
+        return;
+    }
+    const uint8_t* samples[3] = {&rows[0]->blue_, &rows[1]->blue_, &rows[2]->blue_};
+    uint8_t* dst_samples = &dst->blue_;
+    size_t begin = CHANNELS;
+    size_t end = (width - 1) * CHANNELS;
+    if (!has_integer_weights_) {
+        ConvolveSamplesUnit(samples, dst_samples, begin, end, weights_);
+        return;
+    }
+#ifdef IMAGE_PROCESSOR_X86_SIMD
+    if (simd_level_ == SimdLevel::AVX2) {
+        begin = ConvolveSamplesIntegerAvx2(samples, dst_samples, begin, end, integer_weights_);
+    } else if (simd_level_ == SimdLevel::SSE41) {
+        begin = ConvolveSamplesIntegerSse41(samples, dst_samples, begin, end, integer_weights_);
+    }
+#endif
+    ConvolveSamplesInteger(samples, dst_samples, begin, end, integer_weights_);
+}
+
+void Convolution3x3::ConvolveInterior(const FloatPixel* const rows[3], FloatPixel* dst, size_t width) const {
+    if (width < 3) {
+        return;
+    }
+    const float* samples[3] = {&rows[0]->blue_, &rows[1]->blue_, &rows[2]->blue_};
+    float* dst_samples = &dst->blue_;
+    size_t begin = CHANNELS;
+    size_t end = (width - 1) * CHANNELS;
+#ifdef IMAGE_PROCESSOR_X86_SIMD
+    if (simd_level_ == SimdLevel::AVX2) {
+        begin = ConvolveSamplesUnitAvx2(samples, dst_samples, begin, end, weights_);
+    } else if (simd_level_ == SimdLevel::SSE41) {
+        begin = ConvolveSamplesUnitSse41(samples, dst_samples, begin, end, weights_);
+    }
+#endif
+    ConvolveSamplesUnit(samples, dst_samples, begin, end, weights_);
+}
+
+namespace {
+
+template <typename T>
+void LoadPaddedRow(const BasicPixel<T>* row, size_t width, size_t radius, std::vector<float>& padded) {
+    padded.resize((width + 2 * radius) * CHANNELS);
+    for (size_t x = 0; x < width + 2 * radius; ++x) {
+        const BasicPixel<T>& pixel = row[std::clamp(x, radius, radius + width - 1) - radius];
+        padded[x * CHANNELS] = static_cast<float>(SampleTraits<T>::ToUnit(pixel.blue_));
+        padded[x * CHANNELS + 1] = static_cast<float>(SampleTraits<T>::ToUnit(pixel.green_));
+        padded[x * CHANNELS + 2] = static_cast<float>(SampleTraits<T>::ToUnit(pixel.red_));
+    }
+}
+
+void AccumulateRow(const float* src, float weight, size_t samples, float* sum) {
+    for (size_t s = 0; s < samples; ++s) {
+        sum[s] += weight * src[s];
+    }
+}
+
+template <typename T>
+void StoreRow(const std::vector<float>& sum, BasicPixel<T>* row) {
+    T* samples = &row->blue_;
+    for (size_t s = 0; s < sum.size(); ++s) {
+        samples[s] = SampleTraits<T>::FromUnit(std::clamp(static_cast<double>(sum[s]), 0.0, 1.0));
+    }
+}
+
+template <typename T>
+const BasicPixel<T>* GetClampedRow(const BasicImage<T>& image, ptrdiff_t row) {
+    return image.GetRow(std::clamp<ptrdiff_t>(row, 0, static_cast<ptrdiff_t>(image.GetHeight()) - 1));
+}
+
+}  // namespace
+
+Convolution::Convolution(FilterMatrix matrix) : matrix_(std::move(matrix)) {
+    if (matrix_.empty() || matrix_.size() % 2 == 0 || matrix_[0].size() % 2 == 0) {
+        throw std::invalid_argument("Convolution takes a filter matrix with odd numbers of rows and columns");
+    }
+    for (const std::vector<double>& row : matrix_) {
+        if (row.size() != matrix_[0].size()) {
+            throw std::invalid_argument("Convolution takes a rectangular filter matrix");
+        }
+    }
+    radius_rows_ = matrix_.size() / 2;
+    radius_cols_ = matrix_[0].size() / 2;
+    FindSeparableFactors();
+}
+
+void Convolution::FindSeparableFactors() {
+    size_t pivot_row = 0;
+    size_t pivot_col = 0;
+    double max_weight = 0;
+    for (size_t i = 0; i < matrix_.size(); ++i) {
+        for (size_t j = 0; j < matrix_[i].size(); ++j) {
+            if (std::abs(matrix_[i][j]) > max_weight) {
+                max_weight = std::abs(matrix_[i][j]);
+                pivot_row = i;
+                pivot_col = j;
+            }
+        }
+    }
+    if (max_weight == 0) {
+        return;
+    }
+    for (size_t i = 0; i < matrix_.size(); ++i) {
+        for (size_t j = 0; j < matrix_[i].size(); ++j) {
+            double rank_one = matrix_[i][pivot_col] * matrix_[pivot_row][j] / matrix_[pivot_row][pivot_col];
+            if (std::abs(matrix_[i][j] - rank_one) > SEPARABILITY_TOLERANCE * max_weight) {
+                return;
+            }
+        }
+    }
+    for (size_t i = 0; i < matrix_.size(); ++i) {
+        column_.push_back(static_cast<float>(matrix_[i][pivot_col]));
+    }
+    for (size_t j = 0; j < matrix_[pivot_row].size(); ++j) {
+        row_.push_back(static_cast<float>(matrix_[pivot_row][j] / matrix_[pivot_row][pivot_col]));
+    }
+    separable_ = true;
+}
+
+size_t Convolution::GetRadius() const {
+    return std::max(radius_rows_, radius_cols_);
+}
+
+bool Convolution::IsSeparable() const {
+    return separable_;
+}
+
+template <typename T>
+void Convolution::Apply(const BasicImage<T>& image, BasicImage<T>& dst, const RowOperation<T>& pre,
+                        const RowOperation<T>& post) const {
+    dst.Reset(image.GetWidth(), image.GetHeight());
+    if (image.GetWidth() == 0 || image.GetHeight() == 0) {
+        return;
+    }
+    if (separable_) {
+        ApplySeparable(image, dst, pre, post);
+    } else {
+        ApplyDirect(image, dst, pre, post);
+    }
+}
+
+template <typename T>
+void Convolution::ApplySeparable(const BasicImage<T>& image, BasicImage<T>& dst, const RowOperation<T>& pre,
+                                 const RowOperation<T>& post) const {
+    size_t samples = image.GetWidth() * CHANNELS;
+    FloatImage horizontal(image.GetWidth(), image.GetHeight());
+    ThreadPool::GetDefault().ParallelFor(image.GetHeight(), [&](size_t begin, size_t end) {
+        TransformedRows<T> source(image, pre, 1);
+        std::vector<float> padded;
+        for (size_t y = begin; y < end; ++y) {
+            LoadPaddedRow(source.GetRow(y), image.GetWidth(), radius_cols_, padded);
+            float* sum = &horizontal.GetRow(y)->blue_;
+            for (size_t j = 0; j < row_.size(); ++j) {
+                AccumulateRow(padded.data() + j * CHANNELS, row_[j], samples, sum);
+            }
+        }
+    });
+
+    ThreadPool::GetDefault().ParallelFor(image.GetHeight(), [&](size_t begin, size_t end) {
+        std::vector<float> sum(samples);
+        for (size_t y = begin; y < end; ++y) {
+            std::fill(sum.begin(), sum.end(), 0.0f);
+            for (size_t i = 0; i < column_.size(); ++i) {
+                const FloatPixel* row = GetClampedRow(horizontal, static_cast<ptrdiff_t>(y + i) - static_cast<ptrdiff_t>(radius_rows_));
+                AccumulateRow(&row->blue_, column_[i], samples, sum.data());
+            }
+            StoreRow(sum, dst.GetRow(y));
+            if (post) {
+                post(dst.GetRowSpan(y));
+            }
+        }
+    });
+}
+
+template <typename T>
+void Convolution::ApplyDirect(const BasicImage<T>& image, BasicImage<T>& dst, const RowOperation<T>& pre,
+                              const RowOperation<T>& post) const {
+    size_t samples = image.GetWidth() * CHANNELS;
+    ThreadPool::GetDefault().ParallelFor(image.GetHeight(), [&](size_t begin, size_t end) {
+        TransformedRows<T> source(image, pre, matrix_.size());
+        std::vector<float> padded;
+        std::vector<float> sum(samples);
+        for (size_t y = begin; y < end; ++y) {
+            std::fill(sum.begin(), sum.end(), 0.0f);
+            for (size_t i = 0; i < matrix_.size(); ++i) {
+                ptrdiff_t row = static_cast<ptrdiff_t>(y + i) - static_cast<ptrdiff_t>(radius_rows_);
+                LoadPaddedRow(source.GetRow(std::clamp<ptrdiff_t>(row, 0, static_cast<ptrdiff_t>(image.GetHeight()) - 1)),
+                              image.GetWidth(), radius_cols_, padded);
+                for (size_t j = 0; j < matrix_[i].size(); ++j) {
+                    if (matrix_[i][j] != 0) {
+                        AccumulateRow(padded.data() + j * CHANNELS, static_cast<float>(matrix_[i][j]), samples,
+                                      sum.data());
+                    }
+                }
+            }
+            StoreRow(sum, dst.GetRow(y));
+            if (post) {
+                post(dst.GetRowSpan(y));
+            }
+        }
+    });
+}
+
+template void Convolution::Apply(const Image& image, Image& dst, const RowOperation<uint8_t>& pre,
+                                 const RowOperation<uint8_t>& post) const;
+template void Convolution::Apply(const FloatImage& image, FloatImage& dst, const RowOperation<float>& pre,
+                                 const RowOperation<float>& post) const;
+
+BoxFilter::BoxFilter(std::vector<size_t> radii) : radii_(std::move(radii)) {
+}
+
+size_t BoxFilter::GetRadius() const {
+    size_t radius = 0;
+    for (size_t box_radius : radii_) {
+        radius += box_radius;
+    }
+    return radius;
+}
+
+void BoxFilter::Apply(const Image& image, Image& dst, const RowOperation<uint8_t>& pre,
+                      const RowOperation<uint8_t>& post) const {
+    dst.Reset(image.GetWidth(), image.GetHeight());
+    if (image.GetWidth() == 0 || image.GetHeight() == 0) {
+        return;
+    }
+    FloatImage current(image.GetWidth(), image.GetHeight());
+    ThreadPool::GetDefault().ParallelFor(image.GetHeight(), [&](size_t begin, size_t end) {
+        TransformedRows<uint8_t> source(image, pre, 1);
+        for (size_t y = begin; y < end; ++y) {
+            const Pixel* row = source.GetRow(y);
+            FloatPixel* float_row = current.GetRow(y);
+            for (size_t x = 0; x < image.GetWidth(); ++x) {
+                float_row[x] = ConvertPixel<float>(row[x]);
+            }
+        }
+    });
+    FloatImage buffer(image.GetWidth(), image.GetHeight());
+    for (size_t radius : radii_) {
+        ApplyHorizontal(current, buffer, radius);
+        ApplyVertical(buffer, current, radius);
+    }
+    ThreadPool::GetDefault().ParallelFor(image.GetHeight(), [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+            const FloatPixel* float_row = current.GetRow(y);
+            Pixel* row = dst.GetRow(y);
+            for (size_t x = 0; x < image.GetWidth(); ++x) {
+                row[x] = ConvertPixel<uint8_t>(float_row[x]);
+            }
+            if (post) {
+                post(dst.GetRowSpan(y));
+            }
+        }
+    });
+}
+
+void BoxFilter::ApplyHorizontal(const FloatImage& src, FloatImage& dst, size_t radius) {
+    size_t width = src.GetWidth();
+    double scale = 1.0 / static_cast<double>(2 * radius + 1);
+    ThreadPool::GetDefault().ParallelFor(src.GetHeight(), [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+            const float* src_row = &src.GetRow(y)->blue_;
+            float* dst_row = &dst.GetRow(y)->blue_;
+            auto clamped = [width](ptrdiff_t x) {
+                return static_cast<size_t>(std::clamp<ptrdiff_t>(x, 0, static_cast<ptrdiff_t>(width) - 1));
+            };
+            for (size_t c = 0; c < CHANNELS; ++c) {
+                double sum = 0;
+                for (ptrdiff_t x = -static_cast<ptrdiff_t>(radius); x <= static_cast<ptrdiff_t>(radius); ++x) {
+                    sum += src_row[clamped(x) * CHANNELS + c];
+                }
+                for (size_t x = 0; x < width; ++x) {
+                    dst_row[x * CHANNELS + c] = static_cast<float>(sum * scale);
+                    ptrdiff_t x_signed = static_cast<ptrdiff_t>(x);
+                    sum += src_row[clamped(x_signed + static_cast<ptrdiff_t>(radius) + 1) * CHANNELS + c];
+                    sum -= src_row[clamped(x_signed - static_cast<ptrdiff_t>(radius)) * CHANNELS + c];
+                }
+            }
+        }
+    });
+}
+
+void BoxFilter::ApplyVertical(const FloatImage& src, FloatImage& dst, size_t radius) {
+    size_t samples = src.GetWidth() * CHANNELS;
+    double scale = 1.0 / static_cast<double>(2 * radius + 1);
+    ptrdiff_t signed_radius = static_cast<ptrdiff_t>(radius);
+    ThreadPool::GetDefault().ParallelFor(src.GetHeight(), [&](size_t begin, size_t end) {
+        std::vector<double> sum(samples, 0.0);
+        for (ptrdiff_t y = static_cast<ptrdiff_t>(begin) - signed_radius;
+             y <= static_cast<ptrdiff_t>(begin) + signed_radius; ++y) {
+            const float* row = &GetClampedRow(src, y)->blue_;
+            for (size_t s = 0; s < samples; ++s) {
+                sum[s] += row[s];
+            }
+        }
+        for (size_t y = begin; y < end; ++y) {
+            float* dst_row = &dst.GetRow(y)->blue_;
+            const float* added = &GetClampedRow(src, static_cast<ptrdiff_t>(y) + signed_radius + 1)->blue_;
+            const float* removed = &GetClampedRow(src, static_cast<ptrdiff_t>(y) - signed_radius)->blue_;
+            for (size_t s = 0; s < samples; ++s) {
+                dst_row[s] = static_cast<float>(sum[s] * scale);
+                sum[s] += added[s] - static_cast<double>(removed[s]);
+            }
+        }
+    });
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "image.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <span>
+#include <vector>
+
+using FilterMatrix = std::vector<std::vector<double>>;
+
+// A per-pixel operation run on whole rows; lets a convolution fuse the pointwise work before or after it.
+template <typename T>
+using RowOperation = std::function<void(std::span<BasicPixel<T>>)>;
+
+// Source rows with an optional row operation applied on first use. Keeps the last few transformed rows, so rows
+// must be requested in non-decreasing order within a window of at most capacity rows.
+template <typename T>
+class TransformedRows {
+public:
+    TransformedRows(const BasicImage<T>& image, const RowOperation<T>& operation, size_t capacity)
+        : image_(image),
+          operation_(operation),
+          buffer_(operation ? image.GetWidth() : 0, operation ? capacity : 0),
+          rows_(operation ? capacity : 0, NO_ROW) {
+    }
+
+    const BasicPixel<T>* GetRow(size_t row) {
+        if (!operation_) {
+            return image_.GetRow(row);
+        }
+        size_t slot = 0;
+        for (size_t i = 0; i < rows_.size(); ++i) {
+            if (rows_[i] == row) {
+                return buffer_.GetRow(i);
+            }
+            if (rows_[slot] != NO_ROW && (rows_[i] == NO_ROW || rows_[i] < rows_[slot])) {
+                slot = i;
+            }
+        }
+        std::copy_n(image_.GetRow(row), image_.GetWidth(), buffer_.GetRow(slot));
+        operation_(buffer_.GetRowSpan(slot));
+        rows_[slot] = row;
+        return buffer_.GetRow(slot);
+    }
+
+private:
+    static constexpr size_t NO_ROW = std::numeric_limits<size_t>::max();
+
+    const BasicImage<T>& image_;
+    const RowOperation<T>& operation_;
+    BasicImage<T> buffer_;
+    std::vector<size_t> rows_;
+};
+
+enum class SimdLevel { SCALAR, SSE41, AVX2 };
+
+SimdLevel DetectSimdLevel();
+
+class Convolution3x3 {
+public:
+    explicit Convolution3x3(const FilterMatrix& matrix, SimdLevel simd_level = DetectSimdLevel());
+
+    SimdLevel GetSimdLevel() const;
+
+    // Convolves pixels [1, width - 1) of a row; rows are the source rows above, at and below it.
+    void ConvolveInterior(const Pixel* const rows[3], Pixel* dst, size_t width) const;
+
+    void ConvolveInterior(const FloatPixel* const rows[3], FloatPixel* dst, size_t width) const;
+
+private:
+    static const int MAX_INTEGER_WEIGHT_SUM = 128;
+
+    double weights_[3][3] = {};
+    int16_t integer_weights_[3][3] = {};
+    bool has_integer_weights_ = true;
+    SimdLevel simd_level_ = SimdLevel::SCALAR;
+};
+
+class Convolution {
+public:
+    static constexpr double SEPARABILITY_TOLERANCE = 1e-9;
+
+    explicit Convolution(FilterMatrix matrix);
+
+    size_t GetRadius() const;
+
+    bool IsSeparable() const;
+
+    template <typename T>
+    void Apply(const BasicImage<T>& image, BasicImage<T>& dst, const RowOperation<T>& pre = {},
+               const RowOperation<T>& post = {}) const;
+
+private:
+    FilterMatrix matrix_;
+    size_t radius_rows_ = 0;
+    size_t radius_cols_ = 0;
+    std::vector<float> column_;
+    std::vector<float> row_;
+    bool separable_ = false;
+
+    void FindSeparableFactors();
+
+    template <typename T>
+    void ApplySeparable(const BasicImage<T>& image, BasicImage<T>& dst, const RowOperation<T>& pre,
+                        const RowOperation<T>& post) const;
+
+    template <typename T>
+    void ApplyDirect(const BasicImage<T>& image, BasicImage<T>& dst, const RowOperation<T>& pre,
+                     const RowOperation<T>& post) const;
+};
+
+// Box filtering with sliding running sums: the cost per pixel does not depend on the radius.
+class BoxFilter {
+public:
+    explicit BoxFilter(std::vector<size_t> radii);
+
+    size_t GetRadius() const;
+
+    void Apply(const Image& image, Image& dst, const RowOperation<uint8_t>& pre = {},
+               const RowOperation<uint8_t>& post = {}) const;
+
+private:
+    std::vector<size_t> radii_;
+
+    static void ApplyHorizontal(const FloatImage& src, FloatImage& dst, size_t radius);
+
+    static void ApplyVertical(const FloatImage& src, FloatImage& dst, size_t radius);
+};
@@ -0,0 +1,171 @@
+#include "Daemon.h"
+#include "CommandParser.h"
+#include "FilterFactory.h"
+
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define IMAGE_PROCESSOR_HAS_SOCKETS 1
+#endif
+
+namespace {
+
+const char* PROGRAM_NAME = "image_processor";
+
+#ifdef IMAGE_PROCESSOR_HAS_SOCKETS
+
+bool SendAll(int connection, const std::string& data) {
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t result = send(connection, data.data() + sent, data.size() - sent, flags);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+        sent += static_cast<size_t>(result);
+    }
+    return true;
+}
+
+#endif
+
+}  // namespace
+
+Daemon::Daemon(ProcessingOptions options) : options_(options) {
+}
+
+std::string Daemon::HandleRequest(const std::string& request) const {
+    std::istringstream fields(request);
+    std::vector<std::string> words;
+    for (std::string word; fields >> std::quoted(word);) {
+        words.push_back(std::move(word));
+    }
+    if (words.empty()) {
+        return {};
+    }
+    try {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<char*> args = {const_cast<char*>(PROGRAM_NAME)};
+        for (std::string& word : words) {
+            args.push_back(word.data());
+        }
+        CommandParser parsed_request(static_cast<int>(args.size()), args.data());
+        CommandArgs& request_args = parsed_request.GetFiltersData();
+        if (request_args.serving || !request_args.manifest_filename.empty() || !request_args.input_dir.empty() ||
+            request_args.threads != 0 || request_args.profiling ||
+            request_args.huge_pages) {
+            throw std::invalid_argument("Requests take an input, an output and filters, with --stream at most");
+        }
+        ProcessingOptions options = options_;
+        options.streaming = options.streaming || request_args.streaming;
+        if (request_args.strip_height != 0) {
+            options.strip_height = request_args.strip_height;
+        }
+        if (request_args.bits_per_pixel != 0) {
+            options.bits_per_pixel = static_cast<uint16_t>(request_args.bits_per_pixel);
+        }
+        std::vector<std::unique_ptr<Filter>> filters;
+        if (!request_args.filters.empty()) {
+            filters = PlanFilters(CreateFilters(request_args.filters));
+        }
+        ProcessImage(request_args.input_filename, request_args.output_filename, filters, options);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::ostringstream reply;
+        reply << "ok " << std::fixed << std::setprecision(3) << elapsed.count();
+        return reply.str();
+    } catch (const std::exception& error) {
+        return std::string("error ") + error.what();
+    }
+}
+
+void Daemon::Serve(std::istream& requests, std::ostream& replies) const {
+    for (std::string request; std::getline(requests, request);) {
+        std::string reply = HandleRequest(request);
+        if (!reply.empty()) {
+            replies << reply << std::endl;
+        }
+    }
+}
+
+void Daemon::ServeSocket(const std::filesystem::path& socket_path) const {
+#ifdef IMAGE_PROCESSOR_HAS_SOCKETS
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    std::string path = socket_path.string();
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("Socket path is too long: " + path);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    // A socket left behind by an earlier run would make bind fail.
+    if (std::filesystem::is_socket(socket_path)) {
+        std::filesystem::remove(socket_path);
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        throw std::runtime_error("Could not create a socket for " + path);
+    }
+    if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 ||
+        listen(listener, SOMAXCONN) < 0) {
+        close(listener);
+        throw std::runtime_error("Could not listen on " + path);
+    }
+    while (true) {
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            close(listener);
+            throw std::runtime_error("Could not accept a connection on " + path);
+        }
+        std::thread([this, connection] {
+            ServeConnection(connection);
+            close(connection);
+        }).detach();
+    }
+#else
+    throw std::runtime_error("Unix domain sockets are not supported on this platform");
+#endif
+}
+
+void Daemon::ServeConnection(int connection) const {
+#ifdef IMAGE_PROCESSOR_HAS_SOCKETS
+    std::string pending;
+    char buffer[4096];
+    while (true) {
+        ssize_t received = recv(connection, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return;
+        }
+        pending.append(buffer, static_cast<size_t>(received));
+        for (size_t line_end = pending.find('\n'); line_end != std::string::npos; line_end = pending.find('\n')) {
+            std::string reply = HandleRequest(pending.substr(0, line_end));
+            pending.erase(0, line_end + 1);
+            if (!reply.empty() && !SendAll(connection, reply + '\n')) {
+                return;
+            }
+        }
+    }
+#endif
+}
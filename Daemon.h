@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Pipeline.h"
+
+#include <filesystem>
+#include <istream>
+#include <ostream>
+#include <string>
+
+// Serves image requests, one per line, in the command line syntax: "input output -filter params ...", optionally
+// with --stream or --strip-height. Every request gets one reply line, "ok <milliseconds>" or "error <message>".
+// The thread pool and the filter factories stay warm between requests.
+class Daemon {
+public:
+    explicit Daemon(ProcessingOptions options);
+
+    // Serves requests until the input ends.
+    void Serve(std::istream& requests, std::ostream& replies) const;
+
+    // Listens on a Unix domain socket and serves every connection on a thread of its own; does not return.
+    void ServeSocket(const std::filesystem::path& socket_path) const;
+
+    // Returns the reply to a request line, or an empty string for a blank line.
+    std::string HandleRequest(const std::string& request) const;
+
+private:
+    ProcessingOptions options_;
+
+    void ServeConnection(int connection) const;
+};
@@ -1,28 +1,77 @@
 #include "Filter.h"
 #include <algorithm>
+#include <cmath>
+#include <limits>
 
 #include "image.h"
+#include "ThreadPool.h"
+
+namespace {
+
+size_t AddHalo(size_t size, size_t halo) {
+    return size > std::numeric_limits<size_t>::max() - halo ? std::numeric_limits<size_t>::max() : size + halo;
+}
+
+// Float grays are within 0.008 of a luma unit of the exact ones, which moves their Laplacian by less than 0.1 of one;
+// a Laplacian of lumas this close to the threshold is checked in floats.
+const double EDGE_ROUNDING_MARGIN = 0.25;
+
+constexpr int32_t GetGrayWeight(double color_const) {
+    return static_cast<int32_t>(color_const * LookupTable::WEIGHT_SCALE + 0.5);
+}
+
+}  // namespace
+
+size_t Filter::GetHalo() const {
+    return 0;
+}
+
+ImageSize Filter::GetOutputSize(ImageSize input_size) const {
+    return input_size;
+}
+
+ImageSize Filter::GetInputSize(ImageSize output_size) const {
+    return {AddHalo(output_size.width, GetHalo()), AddHalo(output_size.height, GetHalo())};
+}
+
+void Filter::ApplyInto(const Image& image, Image& dst) const {
+    dst = ApplyTo(image);
+}
+
+Image Filter::ApplyToStrip(const Image& strip, size_t) const {
+    return ApplyTo(strip);
+}
 
 Crop::Crop(size_t width, size_t height) : width_(width), height_(height) {
 }
 
-FilterMatrixApplication::FilterMatrixApplication(double corner, double edge, double center) {
-    matrix_ = GetFilterMatrix(edge, corner, center);
-};
+FilterMatrixApplication::FilterMatrixApplication(double corner, double edge, double center)
+    : matrix_(GetFilterMatrix(edge, corner, center)), convolution_(matrix_) {
+}
+
+template <typename T>
+BasicPixel<T> FilterMatrixApplication::GetNewPixel(const BasicImage<T>& org_image, size_t row, size_t col) const {
+    const BasicPixel<T>* rows[3];
+    for (int i = -1; i < 2; ++i) {
+        rows[i + 1] = org_image.GetRow(FixCoord(static_cast<int>(row) + i, org_image.GetHeight()));
+    }
+    return GetNewPixel(rows, org_image.GetWidth(), col);
+}
 
-Pixel FilterMatrixApplication::GetNewPixel(const Image& org_image, size_t row, size_t col) const {
-    Pixel new_pixel;
+template <typename T>
+BasicPixel<T> FilterMatrixApplication::GetNewPixel(const BasicPixel<T>* const rows[3], size_t width,
+                                                   size_t col) const {
+    DoublePixel new_pixel;
     for (int i = -1; i < 2; ++i) {
         for (int j = -1; j < 2; ++j) {
-            size_t temp_row = FixCoord(static_cast<int>(row) + i, org_image.GetHeight());
-            size_t temp_col = FixCoord(static_cast<int>(col) + j, org_image.GetWidth());
-            new_pixel += org_image.GetPixel(temp_row, temp_col) * matrix_[i + 1][j + 1];
+            size_t temp_col = FixCoord(static_cast<int>(col) + j, width);
+            new_pixel += ConvertPixel<double>(rows[i + 1][temp_col]) * matrix_[i + 1][j + 1];
         }
     }
     new_pixel.blue_ = std::clamp(new_pixel.blue_, 0.0, 1.0);
     new_pixel.green_ = std::clamp(new_pixel.green_, 0.0, 1.0);
     new_pixel.red_ = std::clamp(new_pixel.red_, 0.0, 1.0);
-    return new_pixel;
+    return ConvertPixel<T>(new_pixel);
 }
 
 size_t FilterMatrixApplication::FixCoord(int coord, size_t border) const {
@@ -35,15 +84,48 @@ size_t FilterMatrixApplication::FixCoord(int coord, size_t border) const {
     return coord;
 }
 
-Image FilterMatrixApplication::ApplyFilterMatrix(const Image& image) const {
-    Image new_image = image;
-    for (size_t x = 0; x < image.GetHeight(); ++x) {
-        for (size_t y = 0; y < image.GetWidth(); ++y) {
-            Pixel& pixel = new_image.GetPixel(x, y);
-            pixel = GetNewPixel(image, x, y);
+template <typename T>
+void FilterMatrixApplication::ApplyFilterMatrix(const BasicImage<T>& image, BasicImage<T>& dst,
+                                                const RowOperation<T>& pre, const RowOperation<T>& post) const {
+    dst.Reset(image.GetWidth(), image.GetHeight());
+    ThreadPool::GetDefault().ParallelFor(image.GetHeight(), [&](size_t begin, size_t end) {
+        TransformedRows<T> source(image, pre, 3);
+        size_t width = image.GetWidth();
+        for (size_t x = begin; x < end; ++x) {
+            const BasicPixel<T>* rows[3] = {source.GetRow(FixCoord(static_cast<int>(x) - 1, image.GetHeight())),
+                                            source.GetRow(x),
+                                            source.GetRow(FixCoord(static_cast<int>(x) + 1, image.GetHeight()))};
+            BasicPixel<T>* new_row = dst.GetRow(x);
+            ConvolveRow(rows, new_row, width);
+            if (post) {
+                post(dst.GetRowSpan(x));
+            }
+        }
+    });
+}
+
+template <typename T>
+void FilterMatrixApplication::ConvolveRow(const BasicPixel<T>* const rows[3], BasicPixel<T>* dst, size_t width) const {
+    if constexpr (std::is_same_v<T, uint8_t>) {
+        if (convolve_bytes_ != nullptr) {
+            convolve_bytes_(rows, dst, width);
+            return;
+        }
+    } else {
+        if (convolve_floats_ != nullptr) {
+            convolve_floats_(rows, dst, width);
+            return;
+        }
+    }
+    if (width < 3) {
+        for (size_t y = 0; y < width; ++y) {
+            dst[y] = GetNewPixel(rows, width, y);
         }
+        return;
     }
-    return new_image;
+    convolution_.ConvolveInterior(rows, dst, width);
+    dst[0] = GetNewPixel(rows, width, 0);
+    dst[width - 1] = GetNewPixel(rows, width, width - 1);
 }
 
 FilterMatrix FilterMatrixApplication::GetFilterMatrix(double edge, double corner, double center) {
@@ -51,51 +133,269 @@ FilterMatrix FilterMatrixApplication::GetFilterMatrix(double edge, double corner
     return result;
 }
 
-Image Crop::ApplyTo(const Image& image) const {
-    Image cropped_image = image;
-    cropped_image.Resize(width_, height_);
-    return cropped_image;
+Image PointwiseFilter::ApplyTo(const Image& image) const {
+    Image result = image;
+    ApplyInPlace(result);
+    return result;
+}
+
+void PointwiseFilter::ApplyInPlace(Image& image) const {
+    image.MakeWritable();
+    ThreadPool::GetDefault().ParallelFor(image.GetHeight(), [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; ++x) {
+            ApplyToRow(image.GetRowSpan(x));
+        }
+    });
+}
+
+LutFilter::LutFilter(LookupTable table, std::string name) : table_(std::move(table)), name_(std::move(name)) {
+}
+
+std::string LutFilter::GetName() const {
+    return name_;
+}
+
+void LutFilter::ApplyToRow(std::span<Pixel> row) const {
+    table_.ApplyToRow(row);
 }
 
-double GrayScale::GetNewColor(Pixel& pixel) const {
-    return RED_CONST * pixel.red_ + BLUE_CONST * pixel.blue_ + GREEN_CONST * pixel.green_;
+const LookupTable& LutFilter::GetTable() const {
+    return table_;
 }
 
-Image GrayScale::ApplyTo(const Image& image) const {
-    Image gs_image = image;
-    for (size_t x = 0; x < gs_image.GetHeight(); ++x) {
-        for (size_t y = 0; y < gs_image.GetWidth(); ++y) {
-            Pixel& pixel = gs_image.GetPixel(x, y);
-            double new_color = GetNewColor(pixel);
-            pixel.blue_ = new_color;
-            pixel.green_ = new_color;
-            pixel.red_ = new_color;
+FusedPointwiseFilter::FusedPointwiseFilter(std::vector<std::unique_ptr<PointwiseFilter>> filters) {
+    for (std::unique_ptr<PointwiseFilter>& filter : filters) {
+        name_ += (name_.empty() ? "" : "+") + filter->GetName();
+        const LutFilter* table = dynamic_cast<const LutFilter*>(filter.get());
+        const LutFilter* previous = filters_.empty() ? nullptr : dynamic_cast<const LutFilter*>(filters_.back().get());
+        if (table != nullptr && previous != nullptr) {
+            filters_.back() = std::make_unique<LutFilter>(previous->GetTable().Then(table->GetTable()),
+                                                        previous->GetName() + "+" + table->GetName());
+        } else {
+            filters_.push_back(std::move(filter));
         }
     }
+}
+
+std::string FusedPointwiseFilter::GetName() const {
+    return name_;
+}
+
+void FusedPointwiseFilter::ApplyToRow(std::span<Pixel> row) const {
+    for (const std::unique_ptr<PointwiseFilter>& filter : filters_) {
+        filter->ApplyToRow(row);
+    }
+}
+
+NeighbourhoodFilter::NeighbourhoodFilter(std::string name) : name_(std::move(name)) {
+}
+
+std::string NeighbourhoodFilter::GetName() const {
+    std::string name = name_;
+    if (pre_filter_) {
+        name = pre_filter_->GetName() + "+" + name;
+    }
+    if (post_filter_) {
+        name += "+" + post_filter_->GetName();
+    }
+    return name;
+}
+
+Image NeighbourhoodFilter::ApplyTo(const Image& image) const {
+    Image result;
+    ApplyInto(image, result);
+    return result;
+}
+
+bool NeighbourhoodFilter::HasPreFilter() const {
+    return pre_filter_ != nullptr;
+}
+
+bool NeighbourhoodFilter::HasPostFilter() const {
+    return post_filter_ != nullptr;
+}
+
+void NeighbourhoodFilter::FusePreFilter(std::unique_ptr<PointwiseFilter> filter) {
+    pre_filter_ = std::move(filter);
+}
+
+void NeighbourhoodFilter::FusePostFilter(std::unique_ptr<PointwiseFilter> filter) {
+    post_filter_ = std::move(filter);
+}
+
+RowOperation<uint8_t> NeighbourhoodFilter::GetPreOperation() const {
+    if (!pre_filter_) {
+        return {};
+    }
+    return [this](std::span<Pixel> row) { pre_filter_->ApplyToRow(row); };
+}
+
+RowOperation<uint8_t> NeighbourhoodFilter::GetPostOperation() const {
+    if (!post_filter_) {
+        return {};
+    }
+    return [this](std::span<Pixel> row) { post_filter_->ApplyToRow(row); };
+}
+
+Image Crop::ApplyTo(const Image& image) const {
+    return ApplyToStrip(image, 0);
+}
+
+std::string Crop::GetName() const {
+    return "crop";
+}
+
+ImageSize Crop::GetOutputSize(ImageSize input_size) const {
+    return {std::min(width_, input_size.width), std::min(height_, input_size.height)};
+}
+
+ImageSize Crop::GetInputSize(ImageSize output_size) const {
+    return {std::min(width_, output_size.width), std::min(height_, output_size.height)};
+}
+
+Image Crop::ApplyToStrip(const Image& strip, size_t first_row) const {
+    size_t rows = first_row < height_ ? std::min(strip.GetHeight(), height_ - first_row) : 0;
+    return strip.GetView(0, 0, std::min(width_, strip.GetWidth()), rows);
+}
+
+template <typename T>
+double GrayScale::GetNewColor(const BasicPixel<T>& pixel) const {
+    return RED_CONST * SampleTraits<T>::ToUnit(pixel.red_) + BLUE_CONST * SampleTraits<T>::ToUnit(pixel.blue_) +
+           GREEN_CONST * SampleTraits<T>::ToUnit(pixel.green_);
+}
+
+template <typename T>
+BasicImage<T> GrayScale::Convert(const Image& image) const {
+    BasicImage<T> gs_image(image.GetWidth(), image.GetHeight());
+    ThreadPool::GetDefault().ParallelFor(image.GetHeight(), [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; ++x) {
+            const Pixel* row = image.GetRow(x);
+            BasicPixel<T>* gs_row = gs_image.GetRow(x);
+            for (size_t y = 0; y < image.GetWidth(); ++y) {
+                T new_color = SampleTraits<T>::FromUnit(GetNewColor(row[y]));
+                gs_row[y] = {new_color, new_color, new_color};
+            }
+        }
+    });
     return gs_image;
 }
 
-Image Negative::ApplyTo(const Image& image) const {
-    Image neg_image = image;
-    for (size_t x = 0; x < neg_image.GetHeight(); ++x) {
-        for (size_t y = 0; y < neg_image.GetWidth(); ++y) {
-            Pixel& pixel = neg_image.GetPixel(x, y);
-            pixel.blue_ = 1 - pixel.blue_;
-            pixel.green_ = 1 - pixel.green_;
-            pixel.red_ = 1 - pixel.red_;
+GrayScale::GrayScale() : LutFilter(GetLookupTable(), "gs") {
+}
+
+int32_t GrayScale::GetLuma(const Pixel& pixel) {
+    return GetGrayWeight(RED_CONST) * pixel.red_ + GetGrayWeight(BLUE_CONST) * pixel.blue_ +
+           GetGrayWeight(GREEN_CONST) * pixel.green_;
+}
+
+// With integer weights in thousandths the sum is exact, and flooring it gives the same value as GetNewColor.
+LookupTable GrayScale::GetLookupTable() {
+    return LookupTable::FromGrayWeights(GetGrayWeight(BLUE_CONST), GetGrayWeight(GREEN_CONST),
+                                        GetGrayWeight(RED_CONST));
+}
+
+Negative::Negative()
+    : LutFilter(LookupTable::FromChannelMap([](uint8_t color) { return static_cast<uint8_t>(MAX_COLOR - color); }),
+                "neg") {
+}
+
+Sharpening::Sharpening() : NeighbourhoodFilter("sharp") {
+}
+
+void Sharpening::ApplyInto(const Image& image, Image& dst) const {
+    FilterMatrixApplication applier{Stencil()};
+    applier.ApplyFilterMatrix(image, dst, GetPreOperation(), GetPostOperation());
+}
+
+size_t Sharpening::GetHalo() const {
+    return 1;
+}
+
+GaussianBlur::GaussianBlur(double sigma) : NeighbourhoodFilter("blur"), convolution_(GetGaussianMatrix(sigma)) {
+}
+
+FilterMatrix GaussianBlur::GetGaussianMatrix(double sigma) {
+    size_t radius = std::max<size_t>(1, static_cast<size_t>(std::ceil(3 * sigma)));
+    std::vector<double> weights(2 * radius + 1);
+    double weights_sum = 0;
+    for (size_t i = 0; i < weights.size(); ++i) {
+        double offset = static_cast<double>(i) - static_cast<double>(radius);
+        weights[i] = std::exp(-offset * offset / (2 * sigma * sigma));
+        weights_sum += weights[i];
+    }
+    FilterMatrix result(weights.size(), std::vector<double>(weights.size()));
+    for (size_t i = 0; i < weights.size(); ++i) {
+        for (size_t j = 0; j < weights.size(); ++j) {
+            result[i][j] = weights[i] * weights[j] / (weights_sum * weights_sum);
         }
     }
-    return neg_image;
+    return result;
+}
+
+void GaussianBlur::ApplyInto(const Image& image, Image& dst) const {
+    convolution_.Apply(image, dst, GetPreOperation(), GetPostOperation());
+}
+
+size_t GaussianBlur::GetHalo() const {
+    return convolution_.GetRadius();
+}
+
+BoxBlur::BoxBlur(size_t radius) : NeighbourhoodFilter("box"), box_filter_({radius}) {
+}
+
+void BoxBlur::ApplyInto(const Image& image, Image& dst) const {
+    box_filter_.Apply(image, dst, GetPreOperation(), GetPostOperation());
+}
+
+size_t BoxBlur::GetHalo() const {
+    return box_filter_.GetRadius();
+}
+
+FastGaussianBlur::FastGaussianBlur(double sigma) : NeighbourhoodFilter("fastblur"), box_filter_(GetBoxRadii(sigma)) {
+}
+
+std::vector<size_t> FastGaussianBlur::GetBoxRadii(double sigma) {
+    double passes = static_cast<double>(BOX_PASSES);
+    double ideal_width = std::sqrt(12 * sigma * sigma / passes + 1);
+    int lower_width = static_cast<int>(std::floor(ideal_width));
+    if (lower_width % 2 == 0) {
+        --lower_width;
+    }
+    double lower_passes = (12 * sigma * sigma - passes * lower_width * lower_width - 4 * passes * lower_width -
+                           3 * passes) / (-4 * lower_width - 4);
+    std::vector<size_t> radii;
+    for (size_t pass = 0; pass < BOX_PASSES; ++pass) {
+        int width = static_cast<double>(pass) < std::round(lower_passes) ? lower_width : lower_width + 2;
+        radii.push_back(static_cast<size_t>(width / 2));
+    }
+    return radii;
 }
 
-Image Sharpening::ApplyTo(const Image& image) const {
-    FilterMatrixApplication applier(sharp_const_corners_, sharp_const_edges_, sharp_const_middle_);
-    Image sharp_image = applier.ApplyFilterMatrix(image);
-    return sharp_image;
+void FastGaussianBlur::ApplyInto(const Image& image, Image& dst) const {
+    box_filter_.Apply(image, dst, GetPreOperation(), GetPostOperation());
+}
+
+size_t FastGaussianBlur::GetHalo() const {
+    return box_filter_.GetRadius();
+}
+
+MedianBlur::MedianBlur(size_t radius) : NeighbourhoodFilter("median"), median_filter_(radius) {
+}
+
+void MedianBlur::ApplyInto(const Image& image, Image& dst) const {
+    median_filter_.Apply(image, dst, GetPreOperation(), GetPostOperation());
+}
+
+size_t MedianBlur::GetHalo() const {
+    return median_filter_.GetRadius();
 }
 
 EdgeDetection::EdgeDetection(double threshold) : threshold_(threshold){};
 
+size_t EdgeDetection::GetHalo() const {
+    return 1;
+}
+
 double EdgeDetection::GetBrightness(double color) const {
     if (color > threshold_) {
         return 1.0;
@@ -104,20 +404,96 @@ double EdgeDetection::GetBrightness(double color) const {
 }
 
 Image EdgeDetection::ApplyTo(const Image& image) const {
-    GrayScale filter;
-    Image gs_image = filter.ApplyTo(image);
-
-    FilterMatrixApplication applier(ed_const_corners_, ed_const_edges_, ed_const_middle_);
-    Image ed_image = applier.ApplyFilterMatrix(gs_image);
-
-    for (size_t x = 0; x < image.GetHeight(); ++x) {
-        for (size_t y = 0; y < image.GetWidth(); ++y) {
-            Pixel& pixel = ed_image.GetPixel(x, y);
-            pixel.blue_ = GetBrightness(pixel.blue_);
-            pixel.green_ = GetBrightness(pixel.green_);
-            pixel.red_ = GetBrightness(pixel.red_);
-        }
+    Image result;
+    ApplyInto(image, result);
+    return result;
+}
+
+std::string EdgeDetection::GetName() const {
+    return "edge";
+}
+
+// The Laplacian is taken in integers on exact lumas. Only where it is too close to the threshold for float rounding to
+// be ruled out is the pixel recomputed the way the float pipeline does, so the output does not change.
+template <typename Store>
+void EdgeDetection::Detect(const Image& image, Store store) const {
+    size_t width = image.GetWidth();
+    size_t height = image.GetHeight();
+    // Laplacians below lower are black and above upper are white; the clamped float one is never above a threshold of
+    // 1 or more and always above a negative one.
+    int32_t lower = std::numeric_limits<int32_t>::max();
+    int32_t upper = std::numeric_limits<int32_t>::max();
+    if (threshold_ < 0) {
+        lower = upper = std::numeric_limits<int32_t>::min();
+    } else if (threshold_ < 1) {
+        double scaled_threshold = threshold_ * GrayScale::LUMA_SCALE;
+        lower = static_cast<int32_t>(std::ceil(scaled_threshold - EDGE_ROUNDING_MARGIN));
+        upper = static_cast<int32_t>(std::floor(scaled_threshold + EDGE_ROUNDING_MARGIN));
     }
 
-    return ed_image;
-};
+    ThreadPool::GetDefault().ParallelFor(height, [&](size_t begin, size_t end) {
+        // The lumas of the rows above, at and below the current one, with the edge pixels repeated on both sides.
+        std::vector<int32_t> lumas[3];
+        auto load_lumas = [&](size_t row, std::vector<int32_t>& luma) {
+            const Pixel* pixels = image.GetRow(row);
+            luma.resize(width + 2);
+            for (size_t y = 0; y < width; ++y) {
+                luma[y + 1] = GrayScale::GetLuma(pixels[y]);
+            }
+            luma[0] = luma[1];
+            luma[width + 1] = luma[width];
+        };
+        for (size_t x = begin; x < end; ++x) {
+            if (x == begin) {
+                load_lumas(x == 0 ? 0 : x - 1, lumas[0]);
+                load_lumas(x, lumas[1]);
+            } else {
+                std::swap(lumas[0], lumas[1]);
+                std::swap(lumas[1], lumas[2]);
+            }
+            load_lumas(x + 1 == height ? x : x + 1, lumas[2]);
+            const int32_t* rows[3] = {lumas[0].data(), lumas[1].data(), lumas[2].data()};
+            for (size_t y = 0; y < width; ++y) {
+                int32_t laplacian = Stencil::GetSum<int32_t>(rows, y, y + 1, y + 2);
+                if (laplacian > upper) {
+                    store(x, y, true);
+                } else {
+                    store(x, y, laplacian >= lower && GetExactColor(image, x, y) != 0);
+                }
+            }
+        }
+    });
+}
+
+void EdgeDetection::ApplyInto(const Image& image, Image& dst) const {
+    dst.Reset(image.GetWidth(), image.GetHeight());
+    Detect(image, [&dst](size_t row, size_t col, bool is_edge) {
+        uint8_t color = is_edge ? MAX_COLOR : 0;
+        dst.GetRow(row)[col] = {color, color, color};
+    });
+}
+
+// Rows are whole bytes apart, so threads storing different rows never touch the same byte.
+Bitmask EdgeDetection::ApplyToMask(const Image& image) const {
+    Bitmask mask(image.GetWidth(), image.GetHeight());
+    Detect(image, [&mask](size_t row, size_t col, bool is_edge) {
+        if (is_edge) {
+            mask.Set(row, col);
+        }
+    });
+    return mask;
+}
+
+uint8_t EdgeDetection::GetExactColor(const Image& image, size_t row, size_t col) const {
+    float grays[3][3];
+    for (size_t i = 0; i < 3; ++i) {
+        size_t x = std::clamp(row + i, size_t{1}, image.GetHeight()) - 1;
+        for (size_t j = 0; j < 3; ++j) {
+            size_t y = std::clamp(col + j, size_t{1}, image.GetWidth()) - 1;
+            grays[i][j] = SampleTraits<float>::FromUnit(grayscale_.GetNewColor(image.GetRow(x)[y]));
+        }
+    }
+    const float* rows[3] = {grays[0], grays[1], grays[2]};
+    float laplacian = static_cast<float>(std::clamp(Stencil::GetSum<double>(rows, 0, 1, 2), 0.0, 1.0));
+    return SampleTraits<uint8_t>::FromUnit(GetBrightness(laplacian));
+}
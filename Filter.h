@@ -1,22 +1,49 @@
 #pragma once
 
+#include "Bitmask.h"
+#include "Convolution.h"
 #include "image.h"
+#include "LookupTable.h"
+#include "Median.h"
+#include "Stencil.h"
 #include <cstddef>
-
-using FilterMatrix = std::vector<std::vector<double>>;
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
 
 class FilterMatrixApplication {
 public:
     FilterMatrixApplication(double corner, double edge, double center);
 
-    Pixel GetNewPixel(const Image& org_image, size_t x, size_t y) const;
+    // Convolves whole rows with kernels specialised for the stencil, in integers for 8-bit images.
+    template <int Corner, int Edge, int Center>
+    explicit FilterMatrixApplication(Stencil3x3<Corner, Edge, Center>)
+        : FilterMatrixApplication(Corner, Edge, Center) {
+        convolve_bytes_ = &Stencil3x3<Corner, Edge, Center>::template ConvolveRow<uint8_t>;
+        convolve_floats_ = &Stencil3x3<Corner, Edge, Center>::template ConvolveRow<float>;
+    }
+
+    template <typename T>
+    BasicPixel<T> GetNewPixel(const BasicImage<T>& org_image, size_t x, size_t y) const;
+
+    template <typename T>
+    BasicPixel<T> GetNewPixel(const BasicPixel<T>* const rows[3], size_t width, size_t y) const;
 
     size_t FixCoord(int coord, size_t border) const;
 
-    Image ApplyFilterMatrix(const Image& image) const;
+    template <typename T>
+    void ApplyFilterMatrix(const BasicImage<T>& image, BasicImage<T>& dst, const RowOperation<T>& pre = {},
+                           const RowOperation<T>& post = {}) const;
 
 private:
     FilterMatrix matrix_;
+    Convolution3x3 convolution_;
+    void (*convolve_bytes_)(const Pixel* const rows[3], Pixel* dst, size_t width) = nullptr;
+    void (*convolve_floats_)(const FloatPixel* const rows[3], FloatPixel* dst, size_t width) = nullptr;
+
+    template <typename T>
+    void ConvolveRow(const BasicPixel<T>* const rows[3], BasicPixel<T>* dst, size_t width) const;
 
     FilterMatrix GetFilterMatrix(double edge, double corner, double center);
 };
@@ -24,58 +51,238 @@ private:
 class Filter {
 public:
     virtual Image ApplyTo(const Image&) const = 0;
+
+    // Returns the command line name of the filter; filters merged into one pass join the names of theirs with '+'.
+    virtual std::string GetName() const = 0;
+
+    // Writes the result into dst, which must not share pixels with the image, reusing its buffer where possible.
+    virtual void ApplyInto(const Image& image, Image& dst) const;
+
+    virtual size_t GetHalo() const;
+
+    virtual ImageSize GetOutputSize(ImageSize input_size) const;
+
+    // Returns the size of the top left part of the input that the top left part of the output of the given size
+    // depends on.
+    virtual ImageSize GetInputSize(ImageSize output_size) const;
+
+    virtual Image ApplyToStrip(const Image& strip, size_t first_row) const;
+
     virtual ~Filter() = default;
 };
 
+// A filter whose output pixel depends only on the input pixel at the same place.
+class PointwiseFilter : public Filter {
+public:
+    Image ApplyTo(const Image& image) const override;
+
+    void ApplyInPlace(Image& image) const;
+
+    virtual void ApplyToRow(std::span<Pixel> row) const = 0;
+};
+
+// A pointwise filter that runs through a lookup table.
+class LutFilter : public PointwiseFilter {
+public:
+    LutFilter(LookupTable table, std::string name);
+
+    std::string GetName() const override;
+
+    void ApplyToRow(std::span<Pixel> row) const override;
+
+    const LookupTable& GetTable() const;
+
+private:
+    LookupTable table_;
+    std::string name_;
+};
+
+// Consecutive pointwise filters run as one pass: each row goes through all of them while it is still in cache, and
+// neighbouring lookup table filters are composed into a single table.
+class FusedPointwiseFilter : public PointwiseFilter {
+public:
+    explicit FusedPointwiseFilter(std::vector<std::unique_ptr<PointwiseFilter>> filters);
+
+    std::string GetName() const override;
+
+    void ApplyToRow(std::span<Pixel> row) const override;
+
+private:
+    std::vector<std::unique_ptr<PointwiseFilter>> filters_;
+    std::string name_;
+};
+
+// A filter reading the neighbourhood of each pixel. It can run a pointwise filter on its source rows as it loads
+// them and another one on its output rows as it stores them, saving a pass over the image for each.
+class NeighbourhoodFilter : public Filter {
+public:
+    explicit NeighbourhoodFilter(std::string name);
+
+    Image ApplyTo(const Image& image) const override;
+
+    void ApplyInto(const Image& image, Image& dst) const override = 0;
+
+    std::string GetName() const override;
+
+    bool HasPreFilter() const;
+
+    bool HasPostFilter() const;
+
+    void FusePreFilter(std::unique_ptr<PointwiseFilter> filter);
+
+    void FusePostFilter(std::unique_ptr<PointwiseFilter> filter);
+
+protected:
+    RowOperation<uint8_t> GetPreOperation() const;
+
+    RowOperation<uint8_t> GetPostOperation() const;
+
+private:
+    std::string name_;
+    std::unique_ptr<PointwiseFilter> pre_filter_;
+    std::unique_ptr<PointwiseFilter> post_filter_;
+};
+
+// Keeps the top left corner of the image as a view of the source pixels, without copying them.
 class Crop : public Filter {
 public:
     Crop(size_t width, size_t height);
 
     Image ApplyTo(const Image& image) const override;
 
+    std::string GetName() const override;
+
+    ImageSize GetOutputSize(ImageSize input_size) const override;
+
+    ImageSize GetInputSize(ImageSize output_size) const override;
+
+    Image ApplyToStrip(const Image& strip, size_t first_row) const override;
+
 private:
     size_t width_ = 0;
     size_t height_ = 0;
 };
 
-class GrayScale : public Filter {
+class GrayScale : public LutFilter {
 public:
-    const double RED_CONST = 0.299;
-    const double BLUE_CONST = 0.114;
-    const double GREEN_CONST = 0.587;
+    static constexpr double RED_CONST = 0.299;
+    static constexpr double BLUE_CONST = 0.114;
+    static constexpr double GREEN_CONST = 0.587;
+    // The luma of white.
+    static const int32_t LUMA_SCALE = LookupTable::WEIGHT_SCALE * MAX_COLOR;
 
-    double GetNewColor(Pixel& pixel) const;
+    GrayScale();
 
-    Image ApplyTo(const Image& image) const override;
+    // Returns GetNewColor(pixel) * LUMA_SCALE, computed exactly in integers.
+    static int32_t GetLuma(const Pixel& pixel);
+
+    template <typename T>
+    double GetNewColor(const BasicPixel<T>& pixel) const;
+
+    template <typename T>
+    BasicImage<T> Convert(const Image& image) const;
+
+    static LookupTable GetLookupTable();
 };
 
-class Negative : public Filter {
+class Negative : public LutFilter {
 public:
-    Image ApplyTo(const Image& image) const override;
+    Negative();
 };
 
-class Sharpening : public Filter {
+class Sharpening : public NeighbourhoodFilter {
 public:
-    Image ApplyTo(const Image& image) const override;
+    Sharpening();
+
+    void ApplyInto(const Image& image, Image& dst) const override;
+
+    size_t GetHalo() const override;
+
+private:
+    using Stencil = Stencil3x3<0, -1, 5>;
+};
+
+class GaussianBlur : public NeighbourhoodFilter {
+public:
+    explicit GaussianBlur(double sigma);
+
+    void ApplyInto(const Image& image, Image& dst) const override;
+
+    size_t GetHalo() const override;
+
+    static FilterMatrix GetGaussianMatrix(double sigma);
+
+private:
+    Convolution convolution_;
+};
+
+class BoxBlur : public NeighbourhoodFilter {
+public:
+    explicit BoxBlur(size_t radius);
+
+    void ApplyInto(const Image& image, Image& dst) const override;
+
+    size_t GetHalo() const override;
+
+private:
+    BoxFilter box_filter_;
+};
+
+class FastGaussianBlur : public NeighbourhoodFilter {
+public:
+    static const size_t BOX_PASSES = 3;
+
+    explicit FastGaussianBlur(double sigma);
+
+    void ApplyInto(const Image& image, Image& dst) const override;
+
+    size_t GetHalo() const override;
+
+    static std::vector<size_t> GetBoxRadii(double sigma);
+
+private:
+    BoxFilter box_filter_;
+};
+
+class MedianBlur : public NeighbourhoodFilter {
+public:
+    explicit MedianBlur(size_t radius);
+
+    void ApplyInto(const Image& image, Image& dst) const override;
+
+    size_t GetHalo() const override;
 
 private:
-    const double sharp_const_corners_ = 0;
-    const double sharp_const_edges_ = -1;
-    const double sharp_const_middle_ = 5;
+    MedianFilter median_filter_;
 };
 
-class EdgeDetection : public GrayScale {
+class EdgeDetection : public Filter {
 public:
     explicit EdgeDetection(double threshold);
 
     Image ApplyTo(const Image& image) const override;
 
+    std::string GetName() const override;
+
+    void ApplyInto(const Image& image, Image& dst) const override;
+
+    // Returns the same edges as ApplyTo, one bit per pixel.
+    Bitmask ApplyToMask(const Image& image) const;
+
+    size_t GetHalo() const override;
+
     double GetBrightness(double color) const;
 
 private:
-    const double ed_const_corners_ = 0;
-    const double ed_const_edges_ = -1;
-    const double ed_const_middle_ = 4;
+    using Stencil = Stencil3x3<0, -1, 4>;
+
+    GrayScale grayscale_;
+
+    // Calls store(row, col, is_edge) for every pixel in one pass over the image, each row from a single thread.
+    template <typename Store>
+    void Detect(const Image& image, Store store) const;
+
+    uint8_t GetExactColor(const Image& image, size_t row, size_t col) const;
 
     double threshold_ = 0;
 };
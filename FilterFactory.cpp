@@ -65,6 +65,80 @@ std::string SharpFactory::GetHelpMessage() const {
     return message;
 }
 
+std::unique_ptr<Filter> BlurFactory::Create(const FilterParams& params) const {
+    if (params.size() != 1) {
+        throw std::invalid_argument("Gaussian Blur filter takes 1 parameter");
+    }
+    double sigma = std::stod(static_cast<std::string>(params.at(0)));
+    if (sigma <= 0.0 || sigma > MAX_SIGMA) {
+        throw std::invalid_argument("Sigma must be a positive value not greater than " + std::to_string(MAX_SIGMA));
+    }
+    return std::make_unique<GaussianBlur>(sigma);
+}
+
+std::string BlurFactory::GetHelpMessage() const {
+    std::string message =
+        "Gaussian Blur filter smooths the image with a Gaussian kernel. The filter takes 1 parameter, a positive "
+        "fractional value called sigma, the standard deviation of the kernel in pixels. Command: -blur sigma";
+    return message;
+}
+
+std::unique_ptr<Filter> BoxFactory::Create(const FilterParams& params) const {
+    if (params.size() != 1) {
+        throw std::invalid_argument("Box Blur filter takes 1 parameter");
+    }
+    int radius = std::stoi(static_cast<std::string>(params.at(0)));
+    if (radius < 0) {
+        throw std::invalid_argument("Radius must be a non-negative integer");
+    }
+    return std::make_unique<BoxBlur>(static_cast<size_t>(radius));
+}
+
+std::string BoxFactory::GetHelpMessage() const {
+    std::string message =
+        "Box Blur filter replaces every pixel with the mean of the (2 * radius + 1) square around it, in time that "
+        "does not depend on the radius. The filter takes 1 parameter, a non-negative integer radius. Command: -box "
+        "radius";
+    return message;
+}
+
+std::unique_ptr<Filter> FastBlurFactory::Create(const FilterParams& params) const {
+    if (params.size() != 1) {
+        throw std::invalid_argument("Fast Gaussian Blur filter takes 1 parameter");
+    }
+    double sigma = std::stod(static_cast<std::string>(params.at(0)));
+    if (sigma <= 0.0 || sigma > MAX_SIGMA) {
+        throw std::invalid_argument("Sigma must be a positive value not greater than " + std::to_string(MAX_SIGMA));
+    }
+    return std::make_unique<FastGaussianBlur>(sigma);
+}
+
+std::string FastBlurFactory::GetHelpMessage() const {
+    std::string message =
+        "Fast Gaussian Blur filter approximates a Gaussian blur with three box blurs, in time that does not depend on "
+        "sigma. The filter takes 1 parameter, a positive fractional value called sigma. Command: -fastblur sigma";
+    return message;
+}
+
+std::unique_ptr<Filter> MedianFactory::Create(const FilterParams& params) const {
+    if (params.size() != 1) {
+        throw std::invalid_argument("Median Blur filter takes 1 parameter");
+    }
+    int radius = std::stoi(static_cast<std::string>(params.at(0)));
+    if (radius < 0 || static_cast<size_t>(radius) > MedianFilter::MAX_RADIUS) {
+        throw std::invalid_argument("Radius must be an integer from 0 to " + std::to_string(MedianFilter::MAX_RADIUS));
+    }
+    return std::make_unique<MedianBlur>(static_cast<size_t>(radius));
+}
+
+std::string MedianFactory::GetHelpMessage() const {
+    std::string message =
+        "Median Blur filter replaces every channel of every pixel with its median over the (2 * radius + 1) square "
+        "around it, removing noise while keeping edges sharp, in time that does not depend on the radius. The filter "
+        "takes 1 parameter, an integer radius from 0 to 127. Command: -median radius";
+    return message;
+}
+
 std::unique_ptr<Filter> EDFactory::Create(const FilterParams& params) const {
     if (params.size() != 1) {
         throw std::invalid_argument("Edge Detection filter takes 1 parameter");
@@ -83,13 +157,30 @@ std::string EDFactory::GetHelpMessage() const {
     return message;
 }
 
+namespace {
+
+// Built once and shared by every chain created during the run.
+const std::map<std::string_view, std::unique_ptr<FilterFactory>>& GetFilterFactories() {
+    static const std::map<std::string_view, std::unique_ptr<FilterFactory>> available_filters_map = [] {
+        std::map<std::string_view, std::unique_ptr<FilterFactory>> factories;
+        factories.emplace(std::string_view("crop"), std::make_unique<CropFactory>());
+        factories.emplace(std::string_view("gs"), std::make_unique<GsFactory>());
+        factories.emplace(std::string_view("neg"), std::make_unique<NegFactory>());
+        factories.emplace(std::string_view("sharp"), std::make_unique<SharpFactory>());
+        factories.emplace(std::string_view("edge"), std::make_unique<EDFactory>());
+        factories.emplace(std::string_view("blur"), std::make_unique<BlurFactory>());
+        factories.emplace(std::string_view("box"), std::make_unique<BoxFactory>());
+        factories.emplace(std::string_view("fastblur"), std::make_unique<FastBlurFactory>());
+        factories.emplace(std::string_view("median"), std::make_unique<MedianFactory>());
+        return factories;
+    }();
+    return available_filters_map;
+}
+
+}  // namespace
+
 std::vector<std::unique_ptr<Filter>> CreateFilters(std::vector<FilterArgs>& filters_data) {
-    std::map<std::string_view, std::unique_ptr<FilterFactory>> available_filters_map;
-    available_filters_map.emplace(std::string_view("crop"), std::make_unique<CropFactory>());
-    available_filters_map.emplace(std::string_view("gs"), std::make_unique<GsFactory>());
-    available_filters_map.emplace(std::string_view("neg"), std::make_unique<NegFactory>());
-    available_filters_map.emplace(std::string_view("sharp"), std::make_unique<SharpFactory>());
-    available_filters_map.emplace(std::string_view("edge"), std::make_unique<EDFactory>());
+    const std::map<std::string_view, std::unique_ptr<FilterFactory>>& available_filters_map = GetFilterFactories();
 
     std::vector<std::unique_ptr<Filter>> result;
 
@@ -108,7 +199,7 @@ std::vector<std::unique_ptr<Filter>> CreateFilters(std::vector<FilterArgs>& filt
         if (!available_filters_map.contains(filter_data.filter_name)) {
             throw std::invalid_argument(
                 "The given filter is not implemented. Available filters are Crop, GrayScale, Negative, Sharpening, "
-                "Edge Detection");
+                "Edge Detection, Gaussian Blur, Box Blur, Fast Gaussian Blur, Median Blur");
         }
         result.push_back(available_filters_map.at(filter_data.filter_name)->Create(filter_data.params));
     }
@@ -33,6 +33,30 @@ struct SharpFactory : public FilterFactory {
     std::string GetHelpMessage() const override;
 };
 
+struct BlurFactory : public FilterFactory {
+    static constexpr double MAX_SIGMA = 1000.0;
+
+    std::unique_ptr<Filter> Create(const FilterParams& params) const override;
+    std::string GetHelpMessage() const override;
+};
+
+struct BoxFactory : public FilterFactory {
+    std::unique_ptr<Filter> Create(const FilterParams& params) const override;
+    std::string GetHelpMessage() const override;
+};
+
+struct FastBlurFactory : public FilterFactory {
+    static constexpr double MAX_SIGMA = 10000.0;
+
+    std::unique_ptr<Filter> Create(const FilterParams& params) const override;
+    std::string GetHelpMessage() const override;
+};
+
+struct MedianFactory : public FilterFactory {
+    std::unique_ptr<Filter> Create(const FilterParams& params) const override;
+    std::string GetHelpMessage() const override;
+};
+
 struct EDFactory : public FilterFactory {
     std::unique_ptr<Filter> Create(const FilterParams& params) const override;
     std::string GetHelpMessage() const override;
@@ -0,0 +1,130 @@
+#include "LookupTable.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define IMAGE_PROCESSOR_X86_SIMD 1
+#endif
+
+namespace {
+
+#ifdef IMAGE_PROCESSOR_X86_SIMD
+
+// Looks up 64 bytes at a time: two two-register byte permutes cover the low and the high half of the table.
+__attribute__((target("avx512f,avx512bw,avx512vbmi"))) size_t LookupBytesAvx512(const uint8_t* table, uint8_t* data,
+                                                                                size_t size) {
+    const size_t lanes = 64;
+    __m512i low_first = _mm512_loadu_si512(table);
+    __m512i low_second = _mm512_loadu_si512(table + lanes);
+    __m512i high_first = _mm512_loadu_si512(table + 2 * lanes);
+    __m512i high_second = _mm512_loadu_si512(table + 3 * lanes);
+    size_t i = 0;
+    for (; i + lanes <= size; i += lanes) {
+        __m512i index = _mm512_loadu_si512(data + i);
+        __m512i low = _mm512_permutex2var_epi8(low_first, index, low_second);
+        __m512i high = _mm512_permutex2var_epi8(high_first, index, high_second);
+        _mm512_storeu_si512(data + i, _mm512_mask_blend_epi8(_mm512_movepi8_mask(index), low, high));
+    }
+    return i;
+}
+
+bool HasByteLookupSimd() {
+    static const bool supported = __builtin_cpu_supports("avx512vbmi") && __builtin_cpu_supports("avx512bw");
+    return supported;
+}
+
+#endif
+
+}  // namespace
+
+LookupTable::LookupTable() {
+    for (Table& table : tables_) {
+        for (size_t value = 0; value < table.size(); ++value) {
+            table[value] = static_cast<uint8_t>(value);
+        }
+    }
+}
+
+LookupTable LookupTable::FromChannelMap(const std::function<uint8_t(uint8_t)>& map) {
+    LookupTable result;
+    for (Table& table : result.tables_) {
+        for (size_t value = 0; value < table.size(); ++value) {
+            table[value] = map(static_cast<uint8_t>(value));
+        }
+    }
+    return result;
+}
+
+LookupTable LookupTable::FromGrayWeights(uint32_t blue, uint32_t green, uint32_t red) {
+    LookupTable result;
+    const uint32_t weights[3] = {blue, green, red};
+    for (size_t channel = 0; channel < 3; ++channel) {
+        for (uint32_t value = 0; value <= MAX_COLOR; ++value) {
+            result.weights_[channel][value] = weights[channel] * value;
+        }
+    }
+    result.has_gray_sum_ = true;
+    return result;
+}
+
+LookupTable LookupTable::Then(const LookupTable& next) const {
+    LookupTable result = *this;
+    if (!next.has_gray_sum_) {
+        for (size_t channel = 0; channel < 3; ++channel) {
+            for (size_t value = 0; value <= MAX_COLOR; ++value) {
+                result.tables_[channel][value] = next.tables_[channel][tables_[channel][value]];
+            }
+        }
+        return result;
+    }
+    if (!has_gray_sum_) {
+        for (size_t channel = 0; channel < 3; ++channel) {
+            for (size_t value = 0; value <= MAX_COLOR; ++value) {
+                result.weights_[channel][value] = next.weights_[channel][tables_[channel][value]];
+            }
+        }
+        result.tables_ = next.tables_;
+        result.has_gray_sum_ = true;
+        return result;
+    }
+    // Our output is gray before our tables, so the second sum only depends on that gray value.
+    for (size_t value = 0; value <= MAX_COLOR; ++value) {
+        uint8_t gray = next.GetGray(tables_[0][value], tables_[1][value], tables_[2][value]);
+        for (size_t channel = 0; channel < 3; ++channel) {
+            result.tables_[channel][value] = next.tables_[channel][gray];
+        }
+    }
+    return result;
+}
+
+uint8_t LookupTable::GetGray(uint8_t blue, uint8_t green, uint8_t red) const {
+    return static_cast<uint8_t>((weights_[0][blue] + weights_[1][green] + weights_[2][red]) / WEIGHT_SCALE);
+}
+
+void LookupTable::ApplyToRow(std::span<Pixel> row) const {
+    if (!has_gray_sum_ && tables_[0] == tables_[1] && tables_[1] == tables_[2]) {
+        uint8_t* samples = &row.data()->blue_;
+        size_t size = row.size() * sizeof(Pixel);
+        size_t done = 0;
+#ifdef IMAGE_PROCESSOR_X86_SIMD
+        if (HasByteLookupSimd()) {
+            done = LookupBytesAvx512(tables_[0].data(), samples, size);
+        }
+#endif
+        for (size_t i = done; i < size; ++i) {
+            samples[i] = tables_[0][samples[i]];
+        }
+        return;
+    }
+    if (!has_gray_sum_) {
+        for (Pixel& pixel : row) {
+            pixel.blue_ = tables_[0][pixel.blue_];
+            pixel.green_ = tables_[1][pixel.green_];
+            pixel.red_ = tables_[2][pixel.red_];
+        }
+        return;
+    }
+    for (Pixel& pixel : row) {
+        uint8_t gray = GetGray(pixel.blue_, pixel.green_, pixel.red_);
+        pixel = {tables_[0][gray], tables_[1][gray], tables_[2][gray]};
+    }
+}
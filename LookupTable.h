@@ -0,0 +1,41 @@
+#pragma once
+
+#include "image.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <span>
+
+// An 8-bit pointwise transform: an optional weighted sum of the channels that turns the pixel gray, followed by one
+// 256-entry table per channel. Any chain of such transforms composes into a single one.
+class LookupTable {
+public:
+    static const uint32_t WEIGHT_SCALE = 1000;
+
+    // The identity transform.
+    LookupTable();
+
+    // Maps every channel through the same function.
+    static LookupTable FromChannelMap(const std::function<uint8_t(uint8_t)>& map);
+
+    // Replaces every channel with floor((blue * b + green * g + red * r) / WEIGHT_SCALE); the weights must add up to
+    // WEIGHT_SCALE.
+    static LookupTable FromGrayWeights(uint32_t blue, uint32_t green, uint32_t red);
+
+    // Returns the transform applying this one and then next.
+    LookupTable Then(const LookupTable& next) const;
+
+    void ApplyToRow(std::span<Pixel> row) const;
+
+private:
+    using Table = std::array<uint8_t, MAX_COLOR + 1>;
+    using WeightTable = std::array<uint32_t, MAX_COLOR + 1>;
+
+    // Both in blue, green, red order; the weights already include any table that ran before the sum.
+    std::array<WeightTable, 3> weights_ = {};
+    std::array<Table, 3> tables_ = {};
+    bool has_gray_sum_ = false;
+
+    uint8_t GetGray(uint8_t blue, uint8_t green, uint8_t red) const;
+};
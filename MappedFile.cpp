@@ -0,0 +1,57 @@
+#include "MappedFile.h"
+
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define IMAGE_PROCESSOR_HAS_MMAP 1
+#endif
+
+bool MappedFile::IsSupported() {
+#ifdef IMAGE_PROCESSOR_HAS_MMAP
+    return true;
+#else
+    return false;
+#endif
+}
+
+MappedFile::MappedFile(const std::filesystem::path& file_name) {
+#ifdef IMAGE_PROCESSOR_HAS_MMAP
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open " + file_name.string() + " for mapping");
+    }
+    size_ = std::filesystem::file_size(file_name);
+    if (size_ != 0) {
+        data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data_ == MAP_FAILED) {
+        data_ = nullptr;
+        throw std::runtime_error("Could not map " + file_name.string() + " into memory");
+    }
+    if (data_ != nullptr) {
+        madvise(data_, size_, MADV_SEQUENTIAL);
+    }
+#else
+    throw std::runtime_error("Memory-mapped input is not supported on this platform");
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef IMAGE_PROCESSOR_HAS_MMAP
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+    }
+#endif
+}
+
+const char* MappedFile::GetData() const {
+    return static_cast<const char*>(data_);
+}
+
+size_t MappedFile::GetSize() const {
+    return size_;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+class MappedFile {
+public:
+    explicit MappedFile(const std::filesystem::path& file_name);
+
+    MappedFile(const MappedFile&) = delete;
+
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile();
+
+    static bool IsSupported();
+
+    const char* GetData() const;
+
+    size_t GetSize() const;
+
+private:
+    void* data_ = nullptr;
+    size_t size_ = 0;
+};
@@ -0,0 +1,207 @@
+#include "Median.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+const size_t CHANNELS = 3;
+const size_t BINS = MAX_COLOR + 1;
+const size_t FINE_BINS = 16;
+const size_t COARSE_BINS = BINS / FINE_BINS;
+// The image is filtered in stripes of columns whose histograms, halo included, take about this much, so that they
+// stay in cache from one row to the next.
+const size_t STRIPE_BYTES = 1 << 20;
+
+static_assert((2 * MedianFilter::MAX_RADIUS + 1) * (2 * MedianFilter::MAX_RADIUS + 1) <= UINT16_MAX);
+
+// Counts the samples both per value and per run of FINE_BINS values.
+struct Histogram {
+    std::array<uint16_t, COARSE_BINS> coarse = {};
+    std::array<uint16_t, BINS> fine = {};
+
+    void Add(uint8_t sample) {
+        ++coarse[sample / FINE_BINS];
+        ++fine[sample];
+    }
+
+    void Remove(uint8_t sample) {
+        --coarse[sample / FINE_BINS];
+        --fine[sample];
+    }
+};
+
+// The histogram of one channel in the window around a pixel, moving right along a row one column at a time. Only
+// the coarse counts move with every pixel; the fine counts of a run are brought up to date from the column
+// histograms when the median falls into it, which neighbouring pixels mostly share.
+class WindowHistogram {
+public:
+    // Starts at column x of a row; get_column(x) returns the histogram of column x of the window rows.
+    template <typename GetColumn>
+    void Reset(ptrdiff_t x, ptrdiff_t radius, const GetColumn& get_column) {
+        x_ = x;
+        radius_ = radius;
+        coarse_ = {};
+        for (ptrdiff_t offset = -radius; offset <= radius; ++offset) {
+            const Histogram& column = get_column(x + offset);
+            for (size_t bin = 0; bin < COARSE_BINS; ++bin) {
+                coarse_[bin] += column.coarse[bin];
+            }
+        }
+        // Far enough behind for every run to be rebuilt on first use.
+        fine_position_.fill(x - 2 * radius - 1);
+    }
+
+    template <typename GetColumn>
+    void MoveRight(const GetColumn& get_column) {
+        const Histogram& removed = get_column(x_ - radius_);
+        const Histogram& added = get_column(x_ + radius_ + 1);
+        for (size_t bin = 0; bin < COARSE_BINS; ++bin) {
+            coarse_[bin] += added.coarse[bin] - removed.coarse[bin];
+        }
+        ++x_;
+    }
+
+    // Returns the sample with exactly rank samples below it in sorted order.
+    template <typename GetColumn>
+    uint8_t Select(size_t rank, const GetColumn& get_column) {
+        size_t below = 0;
+        size_t run = 0;
+        while (below + coarse_[run] <= rank) {
+            below += coarse_[run++];
+        }
+        UpdateRun(run, get_column);
+        size_t bin = run * FINE_BINS;
+        while (below + fine_[bin] <= rank) {
+            below += fine_[bin++];
+        }
+        return static_cast<uint8_t>(bin);
+    }
+
+private:
+    std::array<uint16_t, COARSE_BINS> coarse_ = {};
+    std::array<uint16_t, BINS> fine_ = {};
+    // The column each run of fine counts was last brought up to date for.
+    std::array<ptrdiff_t, COARSE_BINS> fine_position_ = {};
+    ptrdiff_t x_ = 0;
+    ptrdiff_t radius_ = 0;
+
+    // Slides the run column by column from where it was left, or sums it anew when that would take longer.
+    template <typename GetColumn>
+    void UpdateRun(size_t run, const GetColumn& get_column) {
+        uint16_t* counts = fine_.data() + run * FINE_BINS;
+        size_t first = run * FINE_BINS;
+        ptrdiff_t& position = fine_position_[run];
+        if (2 * (x_ - position) > 2 * radius_ + 1) {
+            std::fill_n(counts, FINE_BINS, 0);
+            for (ptrdiff_t offset = -radius_; offset <= radius_; ++offset) {
+                const Histogram& column = get_column(x_ + offset);
+                for (size_t bin = 0; bin < FINE_BINS; ++bin) {
+                    counts[bin] += column.fine[first + bin];
+                }
+            }
+        } else {
+            for (; position < x_; ++position) {
+                const Histogram& removed = get_column(position - radius_);
+                const Histogram& added = get_column(position + radius_ + 1);
+                for (size_t bin = 0; bin < FINE_BINS; ++bin) {
+                    counts[bin] += added.fine[first + bin] - removed.fine[first + bin];
+                }
+            }
+        }
+        position = x_;
+    }
+};
+
+size_t Clamp(ptrdiff_t index, size_t size) {
+    return static_cast<size_t>(std::clamp<ptrdiff_t>(index, 0, static_cast<ptrdiff_t>(size) - 1));
+}
+
+}  // namespace
+
+MedianFilter::MedianFilter(size_t radius) : radius_(radius) {
+    if (radius > MAX_RADIUS) {
+        throw std::invalid_argument("Median filter takes a radius of at most " + std::to_string(MAX_RADIUS));
+    }
+}
+
+size_t MedianFilter::GetRadius() const {
+    return radius_;
+}
+
+void MedianFilter::Apply(const Image& image, Image& dst, const RowOperation<uint8_t>& pre,
+                         const RowOperation<uint8_t>& post) const {
+    size_t width = image.GetWidth();
+    size_t height = image.GetHeight();
+    dst.Reset(width, height);
+    if (width == 0 || height == 0) {
+        return;
+    }
+    ptrdiff_t radius = static_cast<ptrdiff_t>(radius_);
+    size_t window = 2 * radius_ + 1;
+    size_t median_rank = window * window / 2;
+    size_t cached_columns = STRIPE_BYTES / (CHANNELS * sizeof(Histogram));
+    size_t stripe_width = std::max(cached_columns > 2 * radius_ ? cached_columns - 2 * radius_ : 0, window);
+    ThreadPool::GetDefault().ParallelFor(height, [&](size_t begin, size_t end) {
+        std::vector<Histogram> columns;
+        WindowHistogram window_histograms[CHANNELS];
+        for (size_t left = 0; left < width; left += stripe_width) {
+            size_t right = std::min(left + stripe_width, width);
+            // The histograms cover the columns of the stripe and of its halo, from first_column to last_column.
+            size_t first_column = left - std::min(left, radius_);
+            size_t last_column = std::min(right + radius_, width);
+            size_t first_sample = first_column * CHANNELS;
+            size_t last_sample = last_column * CHANNELS;
+            columns.assign(last_sample - first_sample, Histogram());
+            // A window row leaves the column histograms 2 * radius + 1 rows after it came in.
+            TransformedRows<uint8_t> source(image, pre, window + 1);
+            auto get_samples = [&](ptrdiff_t row) {
+                return reinterpret_cast<const uint8_t*>(source.GetRow(Clamp(row, height)));
+            };
+            auto get_column = [&](ptrdiff_t x, size_t c) -> const Histogram& {
+                return columns[Clamp(x, width) * CHANNELS + c - first_sample];
+            };
+            for (ptrdiff_t row = static_cast<ptrdiff_t>(begin) - radius;
+                 row <= static_cast<ptrdiff_t>(begin) + radius; ++row) {
+                const uint8_t* samples = get_samples(row);
+                for (size_t s = first_sample; s < last_sample; ++s) {
+                    columns[s - first_sample].Add(samples[s]);
+                }
+            }
+            for (size_t y = begin; y < end; ++y) {
+                if (y != begin) {
+                    const uint8_t* removed = get_samples(static_cast<ptrdiff_t>(y) - radius - 1);
+                    for (size_t s = first_sample; s < last_sample; ++s) {
+                        columns[s - first_sample].Remove(removed[s]);
+                    }
+                    const uint8_t* added = get_samples(static_cast<ptrdiff_t>(y) + radius);
+                    for (size_t s = first_sample; s < last_sample; ++s) {
+                        columns[s - first_sample].Add(added[s]);
+                    }
+                }
+                uint8_t* dst_row = reinterpret_cast<uint8_t*>(dst.GetRow(y));
+                for (size_t c = 0; c < CHANNELS; ++c) {
+                    auto get_channel_column = [&](ptrdiff_t x) -> const Histogram& { return get_column(x, c); };
+                    WindowHistogram& window_histogram = window_histograms[c];
+                    window_histogram.Reset(static_cast<ptrdiff_t>(left), radius, get_channel_column);
+                    for (size_t x = left; x < right; ++x) {
+                        if (x != left) {
+                            window_histogram.MoveRight(get_channel_column);
+                        }
+                        dst_row[x * CHANNELS + c] = window_histogram.Select(median_rank, get_channel_column);
+                    }
+                }
+            }
+        }
+        if (post) {
+            for (size_t y = begin; y < end; ++y) {
+                post(dst.GetRowSpan(y));
+            }
+        }
+    });
+}
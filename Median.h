@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Convolution.h"
+#include "image.h"
+
+#include <cstddef>
+
+// Median filtering with sliding histograms (Perreault and Hebert): every column keeps a histogram of its samples in
+// the window rows, and the window histogram moves along a row by adding one column histogram and removing another,
+// so the cost per pixel does not depend on the radius. The window is the (2 * radius + 1) square around a pixel, with
+// the edge pixels repeated beyond the borders. Rows are split into bands across threads and columns into stripes
+// whose histograms stay in cache.
+class MedianFilter {
+public:
+    // Keeps the counts of a whole window in 16 bits.
+    static const size_t MAX_RADIUS = 127;
+
+    explicit MedianFilter(size_t radius);
+
+    size_t GetRadius() const;
+
+    void Apply(const Image& image, Image& dst, const RowOperation<uint8_t>& pre = {},
+               const RowOperation<uint8_t>& post = {}) const;
+
+private:
+    size_t radius_ = 0;
+};
@@ -0,0 +1,286 @@
+#include "Pipeline.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace {
+
+// A tile pixel goes through a few byte and float buffers in every stage; tiles of L2 size over this keep all of
+// them in cache.
+const size_t TILE_BYTES_PER_PIXEL = 32;
+const size_t DEFAULT_L2_CACHE_SIZE = 1 << 20;
+// Tiles are made at least this many combined halos wide, so that the overlap stays a small part of the work.
+const size_t MIN_TILE_HALOS = 4;
+
+Image CopyRows(const Image& source, size_t first_row, size_t rows, size_t width) {
+    Image result(width, rows);
+    for (size_t row = 0; row < rows; ++row) {
+        std::memcpy(result.GetRow(row), source.GetRow(first_row + row), width * sizeof(Pixel));
+    }
+    return result;
+}
+
+// Numbered, so that two filters of the same kind in a chain get stages of their own.
+std::string GetStageName(const Filter& filter, size_t position) {
+    return "filter " + std::to_string(position + 1) + ": " + filter.GetName();
+}
+
+std::string GetTiledRunName(const std::vector<std::unique_ptr<Filter>>& filters, size_t first, size_t last) {
+    std::string name = "filters " + std::to_string(first + 1) + "-" + std::to_string(last) + " tiled:";
+    for (size_t position = first; position < last; ++position) {
+        name += " " + filters[position]->GetName();
+    }
+    return name;
+}
+
+size_t GetL2CacheSize() {
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (size > 0) {
+        return static_cast<size_t>(size);
+    }
+#endif
+    return DEFAULT_L2_CACHE_SIZE;
+}
+
+void ApplyStage(const Filter& filter, Image& image, Image& spare) {
+    if (const PointwiseFilter* pointwise = dynamic_cast<const PointwiseFilter*>(&filter)) {
+        pointwise->ApplyInPlace(image);
+    } else {
+        filter.ApplyInto(image, spare);
+        std::swap(image, spare);
+    }
+}
+
+// Returns the end of the run of filters from the first one on, up to end, that keep the size of the image.
+size_t GetSameSizeRunEnd(const std::vector<std::unique_ptr<Filter>>& filters, size_t first, size_t end,
+                         ImageSize size) {
+    size_t last = first;
+    while (last < end) {
+        ImageSize output_size = filters[last]->GetOutputSize(size);
+        if (output_size.width != size.width || output_size.height != size.height) {
+            break;
+        }
+        ++last;
+    }
+    return last;
+}
+
+size_t GetTileSide(const std::vector<std::unique_ptr<Filter>>& filters, size_t first, size_t last) {
+    size_t halo = 0;
+    for (size_t position = first; position < last; ++position) {
+        halo += filters[position]->GetHalo();
+    }
+    size_t cache_side = static_cast<size_t>(std::sqrt(static_cast<double>(GetL2CacheSize() / TILE_BYTES_PER_PIXEL)));
+    return std::max({cache_side, MIN_TILE_HALOS * halo, size_t{1}});
+}
+
+// Runs every tile through all the filters [first, last) while it is still in cache. A tile is cut out with the
+// combined halo of the filters around it, and only its centre is kept: there, every filter sees the same
+// neighbourhood as in a pass over the whole image, so the output is the same. Tiles are taken from a shared counter,
+// so that threads which finish early take over the remaining ones.
+void ApplyTiled(const std::vector<std::unique_ptr<Filter>>& filters, size_t first, size_t last, size_t side,
+                const Image& image, Image& dst) {
+    size_t halo = 0;
+    for (size_t position = first; position < last; ++position) {
+        halo += filters[position]->GetHalo();
+    }
+    size_t width = image.GetWidth();
+    size_t height = image.GetHeight();
+    size_t columns = (width + side - 1) / side;
+    size_t tiles = columns * ((height + side - 1) / side);
+    dst.Reset(width, height);
+    std::atomic<size_t> next_tile = 0;
+    ThreadPool& pool = ThreadPool::GetDefault();
+    pool.ParallelFor(std::min(tiles, pool.GetThreadCount()), [&](size_t, size_t) {
+        Image spare;
+        for (size_t tile = next_tile++; tile < tiles; tile = next_tile++) {
+            size_t top = tile / columns * side;
+            size_t left = tile % columns * side;
+            size_t bottom = std::min(top + side, height);
+            size_t right = std::min(left + side, width);
+            size_t region_top = top - std::min(top, halo);
+            size_t region_left = left - std::min(left, halo);
+            Image region = image.GetView(region_top, region_left, std::min(right + halo, width) - region_left,
+                                         std::min(bottom + halo, height) - region_top);
+            for (size_t position = first; position < last; ++position) {
+                ApplyStage(*filters[position], region, spare);
+            }
+            for (size_t y = top; y < bottom; ++y) {
+                std::memcpy(dst.GetRow(y) + left, region.GetRow(y - region_top) + (left - region_left),
+                            (right - left) * sizeof(Pixel));
+            }
+        }
+    });
+}
+
+// Runs the filters before end.
+Image ApplyFilters(const std::vector<std::unique_ptr<Filter>>& filters, size_t end, Image image) {
+    Image spare;
+    for (size_t position = 0; position < end;) {
+        ImageSize size = {image.GetWidth(), image.GetHeight()};
+        size_t run_end = GetSameSizeRunEnd(filters, position, end, size);
+        if (run_end - position >= 2) {
+            size_t side = GetTileSide(filters, position, run_end);
+            if (size.width > side || size.height > side) {
+                ProfileScope profile(GetTiledRunName(filters, position, run_end));
+                ApplyTiled(filters, position, run_end, side, image, spare);
+                std::swap(image, spare);
+                position = run_end;
+                continue;
+            }
+        }
+        ProfileScope profile(GetStageName(*filters[position], position));
+        ApplyStage(*filters[position], image, spare);
+        ++position;
+    }
+    return image;
+}
+
+}  // namespace
+
+std::vector<std::unique_ptr<Filter>> PlanFilters(std::vector<std::unique_ptr<Filter>> filters) {
+    std::vector<std::unique_ptr<Filter>> planned;
+    for (size_t i = 0; i < filters.size();) {
+        std::vector<std::unique_ptr<PointwiseFilter>> run;
+        for (; i < filters.size() && dynamic_cast<PointwiseFilter*>(filters[i].get()) != nullptr; ++i) {
+            run.emplace_back(static_cast<PointwiseFilter*>(filters[i].release()));
+        }
+        if (run.empty()) {
+            planned.push_back(std::move(filters[i++]));
+            continue;
+        }
+        std::unique_ptr<PointwiseFilter> pass;
+        if (run.size() == 1) {
+            pass = std::move(run.front());
+        } else {
+            pass = std::make_unique<FusedPointwiseFilter>(std::move(run));
+        }
+        NeighbourhoodFilter* previous =
+            planned.empty() ? nullptr : dynamic_cast<NeighbourhoodFilter*>(planned.back().get());
+        NeighbourhoodFilter* next =
+            i < filters.size() ? dynamic_cast<NeighbourhoodFilter*>(filters[i].get()) : nullptr;
+        if (previous != nullptr && !previous->HasPostFilter()) {
+            previous->FusePostFilter(std::move(pass));
+        } else if (next != nullptr && !next->HasPreFilter()) {
+            next->FusePreFilter(std::move(pass));
+        } else {
+            planned.push_back(std::move(pass));
+        }
+    }
+    return planned;
+}
+
+ImageSize GetInputRegion(const std::vector<std::unique_ptr<Filter>>& filters) {
+    ImageSize region = UNBOUNDED_SIZE;
+    for (auto filter = filters.rbegin(); filter != filters.rend(); ++filter) {
+        region = (*filter)->GetInputSize(region);
+    }
+    return region;
+}
+
+Image ApplyFilters(const std::vector<std::unique_ptr<Filter>>& filters, Image image) {
+    return ApplyFilters(filters, filters.size(), std::move(image));
+}
+
+StripStage::StripStage(const Filter& filter, ImageSize input_size, std::string name)
+    : filter_(filter),
+      name_(std::move(name)),
+      halo_(filter.GetHalo()),
+      input_size_(input_size),
+      output_size_(filter.GetOutputSize(input_size)),
+      window_first_row_(input_size.height),
+      output_end_(output_size_.height) {
+}
+
+ImageSize StripStage::GetOutputSize() const {
+    return output_size_;
+}
+
+Strip StripStage::Push(const Strip& strip) {
+    ProfileScope profile(name_);
+    size_t kept_rows = std::min(window_.GetHeight(), output_end_ + halo_ - std::min(output_end_ + halo_, window_first_row_));
+    Image window(input_size_.width, strip.rows.GetHeight() + kept_rows);
+    for (size_t row = 0; row < strip.rows.GetHeight(); ++row) {
+        std::memcpy(window.GetRow(row), strip.rows.GetRow(row), input_size_.width * sizeof(Pixel));
+    }
+    for (size_t row = 0; row < kept_rows; ++row) {
+        std::memcpy(window.GetRow(strip.rows.GetHeight() + row), window_.GetRow(row), input_size_.width * sizeof(Pixel));
+    }
+    window_ = std::move(window);
+    window_first_row_ = strip.first_row;
+
+    size_t output_begin = window_first_row_ == 0 ? 0 : std::min(window_first_row_ + halo_, output_end_);
+    if (output_begin >= output_end_) {
+        return {Image(), output_end_};
+    }
+    Image output = filter_.ApplyToStrip(window_, window_first_row_);
+    Strip result{CopyRows(output, output_begin - window_first_row_, output_end_ - output_begin, output.GetWidth()),
+                 output_begin};
+    output_end_ = output_begin;
+    return result;
+}
+
+StripPipeline::StripPipeline(const std::vector<std::unique_ptr<Filter>>& filters, ImageSize input_size)
+    : output_size_(input_size) {
+    for (size_t position = 0; position < filters.size(); ++position) {
+        stages_.emplace_back(*filters[position], output_size_, GetStageName(*filters[position], position));
+        output_size_ = stages_.back().GetOutputSize();
+    }
+}
+
+ImageSize StripPipeline::GetOutputSize() const {
+    return output_size_;
+}
+
+void StripPipeline::Run(BmpReader& reader, BmpWriter& writer, size_t strip_height) {
+    while (reader.GetRowsLeft() > 0) {
+        Strip strip{reader.ReadStrip(strip_height), 0};
+        strip.first_row = reader.GetRowsLeft();
+        for (StripStage& stage : stages_) {
+            strip = stage.Push(strip);
+            if (strip.rows.GetHeight() == 0) {
+                break;
+            }
+        }
+        if (strip.rows.GetHeight() != 0) {
+            writer.WriteStrip(strip.rows);
+        }
+    }
+}
+
+void ProcessImage(const std::filesystem::path& input, const std::filesystem::path& output,
+                  const std::vector<std::unique_ptr<Filter>>& filters, const ProcessingOptions& options) {
+    if (options.streaming) {
+        BmpReader reader(input, GetInputRegion(filters));
+        StripPipeline pipeline(filters, {reader.GetWidth(), reader.GetHeight()});
+        BmpWriter writer(output, pipeline.GetOutputSize().width, pipeline.GetOutputSize().height,
+                         options.bits_per_pixel);
+        pipeline.Run(reader, writer, options.strip_height);
+        return;
+    }
+    Bmp input_file(input, GetInputRegion(filters));
+    const EdgeDetection* edge_detection =
+        filters.empty() ? nullptr : dynamic_cast<const EdgeDetection*>(filters.back().get());
+    if (edge_detection != nullptr && options.bits_per_pixel != DibHeader::BITSPERPIXELDEFAULT) {
+        Image image = ApplyFilters(filters, filters.size() - 1, std::move(input_file).GetImage());
+        Bitmask mask;
+        {
+            ProfileScope profile(GetStageName(*edge_detection, filters.size() - 1));
+            mask = edge_detection->ApplyToMask(image);
+        }
+        Bmp::SaveMask(mask, output, options.bits_per_pixel);
+        return;
+    }
+    Bmp result(ApplyFilters(filters, std::move(input_file).GetImage()));
+    result.Save(output, options.bits_per_pixel);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "BMP.h"
+#include "Filter.h"
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Merges each run of pointwise filters into one pass and folds it into an adjacent neighbourhood filter when one
+// is free to take it. The result produces the same image as the original chain.
+std::vector<std::unique_ptr<Filter>> PlanFilters(std::vector<std::unique_ptr<Filter>> filters);
+
+// Returns the top left part of the input that the output of the chain depends on, halos included. Decoding only
+// that part gives the same output.
+ImageSize GetInputRegion(const std::vector<std::unique_ptr<Filter>>& filters);
+
+// Runs the chain on two buffers: pointwise filters work in place, the others write into the spare buffer and the
+// two are swapped, so memory does not grow with the length of the chain. Runs of two or more filters that keep the
+// size of the image go tile by tile, each cache-sized tile through all of them, with the same result.
+Image ApplyFilters(const std::vector<std::unique_ptr<Filter>>& filters, Image image);
+
+struct Strip {
+    Image rows;
+    size_t first_row = 0;
+};
+
+class StripStage {
+public:
+    // The name labels the stage in profiles.
+    StripStage(const Filter& filter, ImageSize input_size, std::string name);
+
+    ImageSize GetOutputSize() const;
+
+    // Takes the rows directly above the previously pushed ones and returns the output rows that became final.
+    Strip Push(const Strip& strip);
+
+private:
+    const Filter& filter_;
+    std::string name_;
+    size_t halo_ = 0;
+    ImageSize input_size_;
+    ImageSize output_size_;
+    Image window_;
+    size_t window_first_row_ = 0;
+    size_t output_end_ = 0;
+};
+
+class StripPipeline {
+public:
+    static const size_t DEFAULT_STRIP_HEIGHT = 64;
+
+    StripPipeline(const std::vector<std::unique_ptr<Filter>>& filters, ImageSize input_size);
+
+    ImageSize GetOutputSize() const;
+
+    void Run(BmpReader& reader, BmpWriter& writer, size_t strip_height = DEFAULT_STRIP_HEIGHT);
+
+private:
+    std::vector<StripStage> stages_;
+    ImageSize output_size_;
+};
+
+struct ProcessingOptions {
+    bool streaming = false;
+    size_t strip_height = StripPipeline::DEFAULT_STRIP_HEIGHT;
+    // Of the output; below 24, only gray or black and white results can be saved.
+    uint16_t bits_per_pixel = DibHeader::BITSPERPIXELDEFAULT;
+};
+
+// Decodes the input image, runs the chain on it and saves the result. A chain ending in edge detection and saved
+// with fewer than 24 bits per pixel writes its edges as a bitmask rather than as a 24-bit image.
+void ProcessImage(const std::filesystem::path& input, const std::filesystem::path& output,
+                  const std::vector<std::unique_ptr<Filter>>& filters, const ProcessingOptions& options);
@@ -0,0 +1,163 @@
+#include "Profiler.h"
+#include "BufferPool.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define IMAGE_PROCESSOR_HAS_RUSAGE 1
+#endif
+
+namespace {
+
+const double MEGABYTE = 1 << 20;
+const double MILLISECONDS = 1000;
+
+std::mutex stages_mutex;
+std::vector<StageProfile> stages;
+
+std::string QuoteJson(const std::string& text) {
+    std::string quoted = "\"";
+    for (char symbol : text) {
+        if (symbol == '"' || symbol == '\\') {
+            quoted += '\\';
+        }
+        quoted += symbol;
+    }
+    return quoted + "\"";
+}
+
+void WriteText(std::ostream& output, const StageProfile& stage) {
+    output << std::left << std::setw(32) << stage.name << std::right << std::setw(8) << stage.calls << std::fixed
+           << std::setprecision(3) << std::setw(12) << stage.wall_seconds * MILLISECONDS << std::setw(12)
+           << stage.cpu_seconds * MILLISECONDS << std::setprecision(1) << std::setw(14)
+           << static_cast<double>(stage.allocated_bytes) / MEGABYTE << std::setw(14)
+           << static_cast<double>(stage.peak_rss) / MEGABYTE << std::endl;
+}
+
+void WriteJson(std::ostream& output, const StageProfile& stage) {
+    output << "{\"name\": " << QuoteJson(stage.name) << ", \"calls\": " << stage.calls << std::fixed
+           << std::setprecision(6) << ", \"wall_seconds\": " << stage.wall_seconds
+           << ", \"cpu_seconds\": " << stage.cpu_seconds << ", \"allocated_bytes\": " << stage.allocated_bytes
+           << ", \"peak_rss_bytes\": " << stage.peak_rss << "}";
+}
+
+}  // namespace
+
+std::atomic<bool> Profiler::enabled_ = false;
+std::atomic<size_t> Profiler::allocated_bytes_ = 0;
+
+void Profiler::Enable() {
+    enabled_ = true;
+}
+
+size_t Profiler::GetAllocatedBytes() {
+    return allocated_bytes_.load(std::memory_order_relaxed);
+}
+
+void Profiler::AddStage(const StageProfile& stage) {
+    std::lock_guard<std::mutex> lock(stages_mutex);
+    auto same_name = std::find_if(stages.begin(), stages.end(),
+                                  [&](const StageProfile& other) { return other.name == stage.name; });
+    if (same_name == stages.end()) {
+        stages.push_back(stage);
+        return;
+    }
+    same_name->calls += stage.calls;
+    same_name->wall_seconds += stage.wall_seconds;
+    same_name->cpu_seconds += stage.cpu_seconds;
+    same_name->allocated_bytes += stage.allocated_bytes;
+    same_name->peak_rss = std::max(same_name->peak_rss, stage.peak_rss);
+}
+
+std::vector<StageProfile> Profiler::GetStages() {
+    std::lock_guard<std::mutex> lock(stages_mutex);
+    return stages;
+}
+
+void Profiler::Report(std::ostream& output, ProfileFormat format) {
+    std::vector<StageProfile> report = GetStages();
+    BufferPoolStats pool = BufferPool::GetDefault().GetStats();
+    StageProfile total = {"total"};
+    for (const StageProfile& stage : report) {
+        total.calls += stage.calls;
+        total.wall_seconds += stage.wall_seconds;
+        total.cpu_seconds += stage.cpu_seconds;
+        total.allocated_bytes += stage.allocated_bytes;
+        total.peak_rss = std::max(total.peak_rss, stage.peak_rss);
+    }
+    if (format == ProfileFormat::JSON) {
+        output << "{\"stages\": [";
+        for (size_t i = 0; i < report.size(); ++i) {
+            output << (i == 0 ? "" : ", ");
+            WriteJson(output, report[i]);
+        }
+        output << "], \"total\": ";
+        WriteJson(output, total);
+        output << ", \"buffer_pool\": {\"hits\": " << pool.hits << ", \"misses\": " << pool.misses
+               << ", \"hit_rate\": " << std::setprecision(3) << pool.GetHitRate() << "}}" << std::endl;
+        return;
+    }
+    output << std::left << std::setw(32) << "stage" << std::right << std::setw(8) << "calls" << std::setw(12)
+           << "wall ms" << std::setw(12) << "cpu ms" << std::setw(14) << "allocated MB" << std::setw(14)
+           << "peak RSS MB" << std::endl;
+    for (const StageProfile& stage : report) {
+        WriteText(output, stage);
+    }
+    WriteText(output, total);
+    output << "buffer pool: " << pool.hits << " hits, " << pool.misses << " misses, " << std::setprecision(1)
+           << pool.GetHitRate() * 100 << "% hit rate" << std::endl;
+}
+
+size_t Profiler::GetPeakRss() {
+    std::ifstream status("/proc/self/status");
+    for (std::string line; std::getline(status, line);) {
+        if (line.starts_with("VmHWM:")) {
+            return std::stoull(line.substr(line.find_first_not_of(" \t", 6))) * 1024;
+        }
+    }
+#ifdef IMAGE_PROCESSOR_HAS_RUSAGE
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+void Profiler::ResetPeakRss() {
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    if (clear_refs) {
+        clear_refs << "5";
+    }
+}
+
+ProfileScope::ProfileScope(std::string name) {
+    if (!Profiler::IsEnabled()) {
+        return;
+    }
+    active_ = true;
+    name_ = std::move(name);
+    Profiler::ResetPeakRss();
+    allocated_start_ = Profiler::GetAllocatedBytes();
+    cpu_start_ = std::clock();
+    wall_start_ = std::chrono::steady_clock::now();
+}
+
+ProfileScope::~ProfileScope() {
+    if (!active_) {
+        return;
+    }
+    std::chrono::duration<double> wall_time = std::chrono::steady_clock::now() - wall_start_;
+    // std::clock counts the CPU time of every thread of the process.
+    double cpu_time = static_cast<double>(std::clock() - cpu_start_) / CLOCKS_PER_SEC;
+    Profiler::AddStage({std::move(name_), 1, wall_time.count(), cpu_time,
+                        Profiler::GetAllocatedBytes() - allocated_start_, Profiler::GetPeakRss()});
+}
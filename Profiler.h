@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <ctime>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The resources a stage of the job used, summed over all the times it ran: the streaming pipeline runs every stage
+// once per strip.
+struct StageProfile {
+    std::string name;
+    size_t calls = 0;
+    double wall_seconds = 0;
+    double cpu_seconds = 0;
+    size_t allocated_bytes = 0;
+    size_t peak_rss = 0;
+};
+
+enum class ProfileFormat { TEXT, JSON };
+
+// Collects the profile of one job for --profile. Until Enable is called, ProfileScope objects and allocation
+// counting only check a flag.
+class Profiler {
+public:
+    static void Enable();
+
+    static bool IsEnabled() {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // Counts the bytes of a pixel buffer, which is where almost all memory of a job goes.
+    static void CountAllocation(size_t bytes) {
+        if (IsEnabled()) {
+            allocated_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        }
+    }
+
+    static size_t GetAllocatedBytes();
+
+    static void AddStage(const StageProfile& stage);
+
+    static std::vector<StageProfile> GetStages();
+
+    static void Report(std::ostream& output, ProfileFormat format);
+
+    // Returns the peak resident set size of the process in bytes, or 0 where it cannot be queried.
+    static size_t GetPeakRss();
+
+    // Lowers the peak resident set size to the current one, where the system allows that (Linux).
+    static void ResetPeakRss();
+
+private:
+    static std::atomic<bool> enabled_;
+    static std::atomic<size_t> allocated_bytes_;
+};
+
+// Adds the time, CPU time, pixel buffer bytes and peak memory from its construction to its destruction to the stage
+// of the given name. Stages should not nest: each one resets the peak memory when it starts.
+class ProfileScope {
+public:
+    explicit ProfileScope(std::string name);
+
+    ProfileScope(const ProfileScope&) = delete;
+
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    ~ProfileScope();
+
+private:
+    bool active_ = false;
+    std::string name_;
+    std::chrono::steady_clock::time_point wall_start_;
+    std::clock_t cpu_start_ = 0;
+    size_t allocated_start_ = 0;
+};
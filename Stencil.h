@@ -0,0 +1,228 @@
+#pragma once
+
+#include "Convolution.h"
+#include "image.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define IMAGE_PROCESSOR_X86_SIMD 1
+#endif
+
+// A 3x3 stencil with one weight for the four corners, one for the four edges and one for the centre, all known at
+// compile time: zero taps drop out, unit weights turn into additions and subtractions and nothing is loaded per tap
+// but the samples. Matrices only known at run time go through Convolution3x3.
+template <int Corner, int Edge, int Center>
+class Stencil3x3 {
+public:
+    // Convolves a whole row, clamping the columns at its ends; rows are the source rows above, at and below it.
+    // Gives the same result as Convolution3x3 with the same weights inside the row and as
+    // FilterMatrixApplication::GetNewPixel at its ends, with integer sums for bytes.
+    template <typename T>
+    static void ConvolveRow(const BasicPixel<T>* const rows[3], BasicPixel<T>* dst, size_t width) {
+        if (width == 0) {
+            return;
+        }
+        ConvolveInterior(rows, dst, width);
+        const T* samples[3] = {reinterpret_cast<const T*>(rows[0]), reinterpret_cast<const T*>(rows[1]),
+                               reinterpret_cast<const T*>(rows[2])};
+        T* dst_samples = reinterpret_cast<T*>(dst);
+        for (size_t col : {size_t{0}, width - 1}) {
+            size_t left = (col == 0 ? 0 : col - 1) * CHANNELS;
+            size_t right = (col + 1 == width ? col : col + 1) * CHANNELS;
+            for (size_t c = 0; c < CHANNELS; ++c) {
+                dst_samples[col * CHANNELS + c] =
+                    Saturate<T>(GetSum<SumType<T>>(samples, left + c, col * CHANNELS + c, right + c));
+            }
+        }
+    }
+
+    // Convolves pixels [1, width - 1) of a row. Gives the same result as Convolution3x3 with the same weights.
+    static void ConvolveInterior(const Pixel* const rows[3], Pixel* dst, size_t width) {
+        if (width < 3) {
+            return;
+        }
+        const uint8_t* samples[3] = {reinterpret_cast<const uint8_t*>(rows[0]), reinterpret_cast<const uint8_t*>(rows[1]),
+                                     reinterpret_cast<const uint8_t*>(rows[2])};
+        uint8_t* dst_samples = reinterpret_cast<uint8_t*>(dst);
+        size_t begin = CHANNELS;
+#ifdef IMAGE_PROCESSOR_X86_SIMD
+        if (HasAvx2()) {
+            begin = ConvolveBytesAvx2(samples, dst_samples, begin, (width - 1) * CHANNELS);
+        }
+#endif
+        ConvolveSamples(samples, dst_samples, begin, (width - 1) * CHANNELS);
+    }
+
+    static void ConvolveInterior(const FloatPixel* const rows[3], FloatPixel* dst, size_t width) {
+        if (width < 3) {
+            return;
+        }
+        const float* samples[3] = {reinterpret_cast<const float*>(rows[0]), reinterpret_cast<const float*>(rows[1]),
+                                   reinterpret_cast<const float*>(rows[2])};
+        float* dst_samples = reinterpret_cast<float*>(dst);
+        size_t begin = CHANNELS;
+#ifdef IMAGE_PROCESSOR_X86_SIMD
+        if (HasAvx2()) {
+            begin = ConvolveFloatsAvx2(samples, dst_samples, begin, (width - 1) * CHANNELS);
+        }
+#endif
+        ConvolveSamples(samples, dst_samples, begin, (width - 1) * CHANNELS);
+    }
+
+    // Returns the weighted sum around rows[1][center], whose left and right neighbours are at the given indices.
+    // The sum is exact with integer samples and with float samples summed as doubles, so the order of the taps does
+    // not change the result.
+    template <typename Sum, typename T>
+    static Sum GetSum(const T* const rows[3], size_t left, size_t center, size_t right) {
+        Sum sum = Accumulate<Center>(Sum{0}, static_cast<Sum>(rows[1][center]));
+        if constexpr (Edge != 0) {
+            Sum edges = static_cast<Sum>(rows[0][center]) + static_cast<Sum>(rows[2][center]) +
+                        static_cast<Sum>(rows[1][left]) + static_cast<Sum>(rows[1][right]);
+            sum = Accumulate<Edge>(sum, edges);
+        }
+        if constexpr (Corner != 0) {
+            Sum corners = static_cast<Sum>(rows[0][left]) + static_cast<Sum>(rows[0][right]) +
+                          static_cast<Sum>(rows[2][left]) + static_cast<Sum>(rows[2][right]);
+            sum = Accumulate<Corner>(sum, corners);
+        }
+        return sum;
+    }
+
+private:
+    static const size_t CHANNELS = 3;
+
+    static constexpr int Magnitude(int weight) {
+        return weight < 0 ? -weight : weight;
+    }
+
+    // Byte sums are kept in 16-bit lanes.
+    static_assert(4 * Magnitude(Corner) + 4 * Magnitude(Edge) + Magnitude(Center) <= 128);
+
+    template <int Weight, typename Sum>
+    static Sum Accumulate(Sum sum, Sum value) {
+        if constexpr (Weight == 0) {
+            return sum;
+        } else if constexpr (Weight == 1) {
+            return sum + value;
+        } else if constexpr (Weight == -1) {
+            return sum - value;
+        } else {
+            return sum + value * Weight;
+        }
+    }
+
+    template <typename T>
+    using SumType = std::conditional_t<std::is_same_v<T, uint8_t>, int, double>;
+
+    template <typename T, typename Sum>
+    static T Saturate(Sum sum) {
+        if constexpr (std::is_same_v<T, uint8_t>) {
+            return static_cast<uint8_t>(std::clamp(sum, 0, MAX_COLOR));
+        } else {
+            return static_cast<T>(std::clamp(sum, 0.0, 1.0));
+        }
+    }
+
+    template <typename T>
+    static void ConvolveSamples(const T* const rows[3], T* dst, size_t begin, size_t end) {
+        for (size_t s = begin; s < end; ++s) {
+            dst[s] = Saturate<T>(GetSum<SumType<T>>(rows, s - CHANNELS, s, s + CHANNELS));
+        }
+    }
+
+#ifdef IMAGE_PROCESSOR_X86_SIMD
+
+    static bool HasAvx2() {
+        static const bool supported = DetectSimdLevel() == SimdLevel::AVX2;
+        return supported;
+    }
+
+    template <int Weight>
+    __attribute__((target("avx2"))) static __m256i AccumulateAvx2(__m256i sum, __m256i value) {
+        if constexpr (Weight == 0) {
+            return sum;
+        } else if constexpr (Weight == 1) {
+            return _mm256_add_epi16(sum, value);
+        } else if constexpr (Weight == -1) {
+            return _mm256_sub_epi16(sum, value);
+        } else {
+            return _mm256_add_epi16(sum, _mm256_mullo_epi16(value, _mm256_set1_epi16(Weight)));
+        }
+    }
+
+    template <int Weight>
+    __attribute__((target("avx2"))) static __m256d AccumulateAvx2(__m256d sum, __m256d value) {
+        if constexpr (Weight == 0) {
+            return sum;
+        } else if constexpr (Weight == 1) {
+            return _mm256_add_pd(sum, value);
+        } else if constexpr (Weight == -1) {
+            return _mm256_sub_pd(sum, value);
+        } else {
+            return _mm256_add_pd(sum, _mm256_mul_pd(value, _mm256_set1_pd(Weight)));
+        }
+    }
+
+    __attribute__((target("avx2"))) static __m256i LoadBytesAvx2(const uint8_t* samples) {
+        return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples)));
+    }
+
+    __attribute__((target("avx2"))) static __m256d LoadFloatsAvx2(const float* samples) {
+        return _mm256_cvtps_pd(_mm_loadu_ps(samples));
+    }
+
+    __attribute__((target("avx2"))) static size_t ConvolveBytesAvx2(const uint8_t* const rows[3], uint8_t* dst,
+                                                                     size_t begin, size_t end) {
+        const size_t lanes = 16;
+        size_t s = begin;
+        for (; s + lanes <= end; s += lanes) {
+            __m256i sum = AccumulateAvx2<Center>(_mm256_setzero_si256(), LoadBytesAvx2(rows[1] + s));
+            if constexpr (Edge != 0) {
+                __m256i edges = _mm256_add_epi16(
+                    _mm256_add_epi16(LoadBytesAvx2(rows[0] + s), LoadBytesAvx2(rows[2] + s)),
+                    _mm256_add_epi16(LoadBytesAvx2(rows[1] + s - CHANNELS), LoadBytesAvx2(rows[1] + s + CHANNELS)));
+                sum = AccumulateAvx2<Edge>(sum, edges);
+            }
+            if constexpr (Corner != 0) {
+                __m256i corners = _mm256_add_epi16(
+                    _mm256_add_epi16(LoadBytesAvx2(rows[0] + s - CHANNELS), LoadBytesAvx2(rows[0] + s + CHANNELS)),
+                    _mm256_add_epi16(LoadBytesAvx2(rows[2] + s - CHANNELS), LoadBytesAvx2(rows[2] + s + CHANNELS)));
+                sum = AccumulateAvx2<Corner>(sum, corners);
+            }
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(sum, sum), 0xD8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + s), _mm256_castsi256_si128(packed));
+        }
+        return s;
+    }
+
+    __attribute__((target("avx2"))) static size_t ConvolveFloatsAvx2(const float* const rows[3], float* dst,
+                                                                      size_t begin, size_t end) {
+        const size_t lanes = 4;
+        size_t s = begin;
+        for (; s + lanes <= end; s += lanes) {
+            __m256d sum = AccumulateAvx2<Center>(_mm256_setzero_pd(), LoadFloatsAvx2(rows[1] + s));
+            if constexpr (Edge != 0) {
+                __m256d edges = _mm256_add_pd(
+                    _mm256_add_pd(LoadFloatsAvx2(rows[0] + s), LoadFloatsAvx2(rows[2] + s)),
+                    _mm256_add_pd(LoadFloatsAvx2(rows[1] + s - CHANNELS), LoadFloatsAvx2(rows[1] + s + CHANNELS)));
+                sum = AccumulateAvx2<Edge>(sum, edges);
+            }
+            if constexpr (Corner != 0) {
+                __m256d corners = _mm256_add_pd(
+                    _mm256_add_pd(LoadFloatsAvx2(rows[0] + s - CHANNELS), LoadFloatsAvx2(rows[0] + s + CHANNELS)),
+                    _mm256_add_pd(LoadFloatsAvx2(rows[2] + s - CHANNELS), LoadFloatsAvx2(rows[2] + s + CHANNELS)));
+                sum = AccumulateAvx2<Corner>(sum, corners);
+            }
+            sum = _mm256_min_pd(_mm256_max_pd(sum, _mm256_setzero_pd()), _mm256_set1_pd(1.0));
+            _mm_storeu_ps(dst + s, _mm256_cvtpd_ps(sum));
+        }
+        return s;
+    }
+
+#endif
+};
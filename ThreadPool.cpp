@@ -0,0 +1,105 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <exception>
+
+namespace {
+
+size_t default_thread_count = 0;
+
+}  // namespace
+
+ThreadPool::ThreadPool(size_t threads) {
+    for (size_t i = 1; i < threads; ++i) {
+        workers_.emplace_back(&ThreadPool::WorkerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    state_changed_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::GetThreadCount() const {
+    return workers_.size() + 1;
+}
+
+void ThreadPool::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        state_changed_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+        if (tasks_.empty()) {
+            return;
+        }
+        RunPendingTask(lock);
+    }
+}
+
+bool ThreadPool::RunPendingTask(std::unique_lock<std::mutex>& lock) {
+    if (tasks_.empty()) {
+        return false;
+    }
+    std::function<void()> task = std::move(tasks_.front());
+    tasks_.pop_front();
+    lock.unlock();
+    task();
+    lock.lock();
+    return true;
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t, size_t)>& body) {
+    size_t bands = std::min(count, GetThreadCount() * BANDS_PER_THREAD);
+    if (bands <= 1 || workers_.empty()) {
+        if (count != 0) {
+            body(0, count);
+        }
+        return;
+    }
+
+    size_t bands_left = bands;
+    std::exception_ptr error;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (size_t band = 0; band < bands; ++band) {
+        size_t begin = count * band / bands;
+        size_t end = count * (band + 1) / bands;
+        tasks_.emplace_back([this, &body, &bands_left, &error, begin, end] {
+            std::exception_ptr band_error;
+            try {
+                body(begin, end);
+            } catch (...) {
+                band_error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (band_error && !error) {
+                error = band_error;
+            }
+            --bands_left;
+            state_changed_.notify_all();
+        });
+    }
+    state_changed_.notify_all();
+    while (bands_left != 0) {
+        if (!RunPendingTask(lock)) {
+            state_changed_.wait(lock, [this, &bands_left] { return bands_left == 0 || !tasks_.empty(); });
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::SetDefaultThreadCount(size_t threads) {
+    default_thread_count = threads;
+}
+
+ThreadPool& ThreadPool::GetDefault() {
+    static ThreadPool pool(default_thread_count != 0 ? default_thread_count
+                                                      : std::max<size_t>(1, std::thread::hardware_concurrency()));
+    return pool;
+}
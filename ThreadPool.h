@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    static const size_t BANDS_PER_THREAD = 4;
+
+    explicit ThreadPool(size_t threads);
+
+    ThreadPool(const ThreadPool&) = delete;
+
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool();
+
+    size_t GetThreadCount() const;
+
+    // Splits [0, count) into contiguous bands and runs body(begin, end) for each of them. The calling thread
+    // works on bands too, so ParallelFor may be called from inside a band.
+    void ParallelFor(size_t count, const std::function<void(size_t, size_t)>& body);
+
+    static void SetDefaultThreadCount(size_t threads);
+
+    static ThreadPool& GetDefault();
+
+private:
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable state_changed_;
+    bool stopping_ = false;
+
+    void WorkerLoop();
+
+    bool RunPendingTask(std::unique_lock<std::mutex>& lock);
+};
@@ -1,46 +1,142 @@
 #include "image.h"
+#include "BufferPool.h"
+#include "Profiler.h"
 
-Pixel Pixel::operator*(const double value) const {
-    Pixel result;
-    result.blue_ = value * blue_;
-    result.green_ = value * green_;
-    result.red_ = value * red_;
-    return result;
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <utility>
+
+template <typename T>
+BasicImage<T>::BasicImage(size_t width, size_t height) : width_(width), height_(height) {
+    size_t stride = (width * sizeof(PixelType) + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT;
+    stride_ = static_cast<ptrdiff_t>(stride);
+    if (stride * height == 0) {
+        return;
+    }
+    static_assert(ROW_ALIGNMENT <= BufferPool::MIN_CLASS_SIZE, "Pooled buffers must keep rows aligned");
+    Profiler::CountAllocation(stride * height);
+    std::shared_ptr<std::byte> buffer = BufferPool::GetDefault().Acquire(stride * height);
+    capacity_ = BufferPool::GetClassSize(stride * height);
+    origin_ = buffer.get();
+    std::memset(origin_, 0, stride * height);
+    storage_ = std::move(buffer);
+}
+
+template <typename T>
+BasicImage<T>::BasicImage(std::shared_ptr<const std::byte> first_row, ptrdiff_t stride, size_t width, size_t height)
+    : storage_(std::move(first_row)), stride_(stride), width_(width), height_(height), read_only_(true) {
+    origin_ = const_cast<std::byte*>(storage_.get());
+}
+
+template <typename T>
+BasicImage<T>::BasicImage(const BasicImage& other) : BasicImage(other.width_, other.height_) {
+    for (size_t row = 0; row < height_; ++row) {
+        std::memcpy(GetRow(row), other.GetRow(row), width_ * sizeof(PixelType));
+    }
+}
+
+template <typename T>
+BasicImage<T>::BasicImage(BasicImage&& other) noexcept
+    : storage_(std::move(other.storage_)),
+      origin_(std::exchange(other.origin_, nullptr)),
+      stride_(std::exchange(other.stride_, 0)),
+      width_(std::exchange(other.width_, 0)),
+      height_(std::exchange(other.height_, 0)),
+      capacity_(std::exchange(other.capacity_, 0)),
+      read_only_(std::exchange(other.read_only_, false)) {
+}
+
+template <typename T>
+BasicImage<T>& BasicImage<T>::operator=(const BasicImage& other) {
+    if (this != &other) {
+        *this = BasicImage(other);
+    }
+    return *this;
 }
 
-Pixel& Pixel::operator+=(const Pixel& add_pixel) {
-    blue_ += add_pixel.blue_;
-    green_ += add_pixel.green_;
-    red_ += add_pixel.red_;
+template <typename T>
+BasicImage<T>& BasicImage<T>::operator=(BasicImage&& other) noexcept {
+    if (this != &other) {
+        storage_ = std::move(other.storage_);
+        origin_ = std::exchange(other.origin_, nullptr);
+        stride_ = std::exchange(other.stride_, 0);
+        width_ = std::exchange(other.width_, 0);
+        height_ = std::exchange(other.height_, 0);
+        capacity_ = std::exchange(other.capacity_, 0);
+        read_only_ = std::exchange(other.read_only_, false);
+    }
     return *this;
 }
 
-Image::Image(PixelMatrix array) {
-    pixel_matrix_ = array;
+template <typename T>
+size_t BasicImage<T>::GetHeight() const {
+    return height_;
 }
 
-size_t Image::GetHeight() const {
-    return pixel_matrix_.size();
+template <typename T>
+size_t BasicImage<T>::GetWidth() const {
+    return width_;
 }
 
-size_t Image::GetWidth() const {
-    if (GetHeight() == 0) {
-        return 0;
+template <typename T>
+ptrdiff_t BasicImage<T>::GetStride() const {
+    return stride_;
+}
+
+template <typename T>
+bool BasicImage<T>::IsReadOnly() const {
+    return read_only_;
+}
+
+template <typename T>
+void BasicImage<T>::Resize(size_t new_width, size_t new_height) {
+    BasicImage resized(new_width, new_height);
+    size_t common_width = std::min(width_, new_width);
+    for (size_t row = 0; row < std::min(height_, new_height); ++row) {
+        std::memcpy(resized.GetRow(row), GetRow(row), common_width * sizeof(PixelType));
     }
-    return pixel_matrix_[0].size();
+    *this = std::move(resized);
 }
 
-void Image::Resize(size_t new_width, size_t new_height) {
-    pixel_matrix_.resize(new_height);
-    for (size_t i = 0; i < GetHeight(); ++i) {
-        pixel_matrix_[i].resize(new_width);
+template <typename T>
+void BasicImage<T>::Reset(size_t new_width, size_t new_height) {
+    size_t stride = (new_width * sizeof(PixelType) + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT;
+    if (read_only_ || storage_.use_count() > 1 || stride * new_height > capacity_) {
+        // Lets the old buffer go before allocating, so that the two never exist at once.
+        *this = BasicImage();
+        *this = BasicImage(new_width, new_height);
+        return;
     }
+    origin_ = const_cast<std::byte*>(storage_.get());
+    stride_ = static_cast<ptrdiff_t>(stride);
+    width_ = new_width;
+    height_ = new_height;
 }
 
-Pixel& Image::GetPixel(size_t x, size_t y) {
-    return pixel_matrix_[x][y];
+template <typename T>
+BasicImage<T> BasicImage<T>::GetView(size_t first_row, size_t first_col, size_t width, size_t height) const {
+    if (width == 0 || height == 0) {
+        return BasicImage(width, height);
+    }
+    BasicImage view;
+    view.storage_ = storage_;
+    view.origin_ = origin_ + static_cast<ptrdiff_t>(first_row) * stride_ +
+                   static_cast<ptrdiff_t>(first_col * sizeof(PixelType));
+    view.stride_ = stride_;
+    view.width_ = width;
+    view.height_ = height;
+    view.capacity_ = capacity_;
+    view.read_only_ = read_only_;
+    return view;
+}
+
+template <typename T>
+void BasicImage<T>::MakeWritable() {
+    if (read_only_ || storage_.use_count() > 1) {
+        *this = BasicImage(static_cast<const BasicImage&>(*this));
+    }
 }
 
-const Pixel& Image::GetPixel(size_t x, size_t y) const {
-    return pixel_matrix_[x][y];
-}
\ No newline at end of file
+template class BasicImage<uint8_t>;
+template class BasicImage<float>;
@@ -1,36 +1,151 @@
 #pragma once
 
-#include <vector>
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <span>
 
-struct Pixel {
-    double blue_ = 0;
-    double red_ = 0;
-    double green_ = 0;
+const int MAX_COLOR = 255;
 
-    Pixel operator*(const double value) const;
+struct ImageSize {
+    size_t width = 0;
+    size_t height = 0;
+};
+
+// As a region of interest: the whole image, whatever its size.
+const ImageSize UNBOUNDED_SIZE = {std::numeric_limits<size_t>::max(), std::numeric_limits<size_t>::max()};
+
+template <typename T>
+struct BasicPixel {
+    T blue_ = 0;
+    T green_ = 0;
+    T red_ = 0;
+
+    BasicPixel operator*(const double value) const {
+        return {static_cast<T>(value * blue_), static_cast<T>(value * green_), static_cast<T>(value * red_)};
+    }
+
+    BasicPixel& operator+=(const BasicPixel& add_pixel) {
+        blue_ += add_pixel.blue_;
+        green_ += add_pixel.green_;
+        red_ += add_pixel.red_;
+        return *this;
+    }
+};
+
+using Pixel = BasicPixel<uint8_t>;
+using FloatPixel = BasicPixel<float>;
+using DoublePixel = BasicPixel<double>;
+
+template <typename T>
+struct SampleTraits {
+    static double ToUnit(T sample) {
+        return sample;
+    }
 
-    Pixel& operator+=(const Pixel& add_pixel);
+    static T FromUnit(double value) {
+        return static_cast<T>(value);
+    }
 };
 
-class Image {
+template <>
+struct SampleTraits<uint8_t> {
+    static constexpr double QUANTIZATION_EPSILON = 1e-6;
+
+    static double ToUnit(uint8_t sample) {
+        return static_cast<double>(sample) / MAX_COLOR;
+    }
+
+    static uint8_t FromUnit(double value) {
+        return static_cast<uint8_t>(std::clamp(value, 0.0, 1.0) * MAX_COLOR + QUANTIZATION_EPSILON);
+    }
+};
+
+template <typename To, typename From>
+BasicPixel<To> ConvertPixel(const BasicPixel<From>& pixel) {
+    return {SampleTraits<To>::FromUnit(SampleTraits<From>::ToUnit(pixel.blue_)),
+            SampleTraits<To>::FromUnit(SampleTraits<From>::ToUnit(pixel.green_)),
+            SampleTraits<To>::FromUnit(SampleTraits<From>::ToUnit(pixel.red_))};
+}
+
+template <typename T>
+class BasicImage {
 public:
-    using PixelMatrix = std::vector<std::vector<Pixel>>;
+    using PixelType = BasicPixel<T>;
+
+    static const size_t ROW_ALIGNMENT = 64;
+
+    BasicImage() = default;
+
+    BasicImage(size_t width, size_t height);
 
-    Image() = default;
+    BasicImage(std::shared_ptr<const std::byte> first_row, ptrdiff_t stride, size_t width, size_t height);
 
-    explicit Image(PixelMatrix array);
+    BasicImage(const BasicImage& other);
+
+    BasicImage(BasicImage&& other) noexcept;
+
+    BasicImage& operator=(const BasicImage& other);
+
+    BasicImage& operator=(BasicImage&& other) noexcept;
 
     size_t GetWidth() const;
 
     size_t GetHeight() const;
 
+    ptrdiff_t GetStride() const;
+
+    bool IsReadOnly() const;
+
     void Resize(size_t new_width, size_t new_height);
 
-    Pixel& GetPixel(size_t x, size_t y);
+    // Gives the image a new size, keeping its buffer when it is owned and large enough. Pixel values are unspecified.
+    void Reset(size_t new_width, size_t new_height);
+
+    // Returns the given region as an image sharing this one's pixels; the region must lie inside the image.
+    BasicImage GetView(size_t first_row, size_t first_col, size_t width, size_t height) const;
+
+    // Copies the pixels into a buffer of its own if they are read-only or shared with another image.
+    void MakeWritable();
+
+    PixelType* GetRow(size_t row) {
+        return reinterpret_cast<PixelType*>(origin_ + static_cast<ptrdiff_t>(row) * stride_);
+    }
 
-    const Pixel& GetPixel(size_t x, size_t y) const;
+    const PixelType* GetRow(size_t row) const {
+        return reinterpret_cast<const PixelType*>(origin_ + static_cast<ptrdiff_t>(row) * stride_);
+    }
+
+    std::span<PixelType> GetRowSpan(size_t row) {
+        return {GetRow(row), width_};
+    }
+
+    std::span<const PixelType> GetRowSpan(size_t row) const {
+        return {GetRow(row), width_};
+    }
+
+    PixelType& GetPixel(size_t x, size_t y) {
+        return GetRow(x)[y];
+    }
+
+    const PixelType& GetPixel(size_t x, size_t y) const {
+        return GetRow(x)[y];
+    }
 
 private:
-    PixelMatrix pixel_matrix_;
-};
\ No newline at end of file
+    std::shared_ptr<const std::byte> storage_;
+    std::byte* origin_ = nullptr;
+    ptrdiff_t stride_ = 0;
+    size_t width_ = 0;
+    size_t height_ = 0;
+    size_t capacity_ = 0;
+    bool read_only_ = false;
+};
+
+extern template class BasicImage<uint8_t>;
+extern template class BasicImage<float>;
+
+using Image = BasicImage<uint8_t>;
+using FloatImage = BasicImage<float>;
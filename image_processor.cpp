@@ -1,25 +1,60 @@
 #include "CommandParser.h"
+#include "Batch.h"
 #include "BMP.h"
+#include "BufferPool.h"
+#include "Daemon.h"
 #include "FilterFactory.h"
+#include "Pipeline.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+#include <iostream>
 
 int main(int argc, char** argv) {
     CommandParser parsed_command(argc, argv);
 
     CommandArgs& command_args = parsed_command.GetFiltersData();
 
-    Bmp input_file(command_args.input_filename);
+    ThreadPool::SetDefaultThreadCount(command_args.threads);
+    BufferPool::GetDefault().SetHugePages(command_args.huge_pages);
+
+    if (command_args.profiling) {
+        Profiler::Enable();
+    }
+
+    ProcessingOptions options;
+    options.streaming = command_args.streaming;
+    if (command_args.strip_height != 0) {
+        options.strip_height = command_args.strip_height;
+    }
+    if (command_args.bits_per_pixel != 0) {
+        options.bits_per_pixel = static_cast<uint16_t>(command_args.bits_per_pixel);
+    }
 
-    std::vector<std::unique_ptr<Filter>> filters = CreateFilters(command_args.filters);
+    if (command_args.serving) {
+        Daemon daemon(options);
+        if (command_args.socket_path.empty()) {
+            daemon.Serve(std::cin, std::cout);
+        } else {
+            daemon.ServeSocket(command_args.socket_path);
+        }
+        return 0;
+    }
 
-    Image image = input_file.GetImage();
+    std::vector<std::unique_ptr<Filter>> filters = PlanFilters(CreateFilters(command_args.filters));
 
-    for (std::unique_ptr<Filter>& filter : filters) {
-        image = filter->ApplyTo(image);
+    if (!command_args.manifest_filename.empty() || !command_args.input_dir.empty()) {
+        std::vector<BatchJob> jobs = command_args.manifest_filename.empty()
+                                         ? ListBatchDirectory(command_args.input_dir, command_args.output_dir)
+                                         : ReadManifest(command_args.manifest_filename);
+        return RunBatch(jobs, filters, options) == 0 ? 0 : 1;
     }
 
-    Bmp result(image);
+    ProcessImage(command_args.input_filename, command_args.output_filename, filters, options);
 
-    result.Save(command_args.output_filename);
+    if (command_args.profiling) {
+        Profiler::Report(std::cerr, command_args.profile_json ? ProfileFormat::JSON : ProfileFormat::TEXT);
+    }
 
     return 0;
 }
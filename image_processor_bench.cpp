@@ -0,0 +1,258 @@
+#include "BMP.h"
+#include "CommandParser.h"
+#include "FilterFactory.h"
+#include "Pipeline.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace {
+
+const char* PROGRAM_NAME = "image_processor_bench";
+
+const std::vector<double> DEFAULT_MEGAPIXELS = {1, 10, 100};
+const size_t DEFAULT_REPETITIONS = 3;
+
+// Every filter on its own, then the chains we see most in production. Crop takes half of each side.
+const std::vector<std::string> SINGLE_FILTERS = {"-crop", "-gs", "-neg", "-sharp", "-edge 0.1", "-blur 2", "-box 3",
+                                                 "-fastblur 5", "-median 5"};
+const std::vector<std::string> CHAINS = {"-crop -gs -sharp -edge 0.1", "-gs -neg -sharp", "-blur 1.5 -edge 0.05",
+                                         "-neg -fastblur 3 -gs"};
+
+struct BenchOptions {
+    std::vector<double> megapixels = DEFAULT_MEGAPIXELS;
+    size_t repetitions = DEFAULT_REPETITIONS;
+    size_t threads = 0;
+    bool json = false;
+};
+
+struct BenchResult {
+    std::string name;
+    size_t width = 0;
+    size_t height = 0;
+    double seconds = 0;
+    size_t peak_rss = 0;
+};
+
+// Hands the buffers freed by the previous case back to the system, or they would count towards this one, and
+// starts measuring the peak from there.
+void StartMeasuringMemory() {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    Profiler::ResetPeakRss();
+}
+
+// Mapped images are only read on first access, so decoding is timed up to the last pixel having been read.
+uint64_t ReadAllPixels(const Image& image) {
+    uint64_t sum = 0;
+    for (size_t y = 0; y < image.GetHeight(); ++y) {
+        for (const Pixel& pixel : image.GetRowSpan(y)) {
+            sum += pixel.blue_ + pixel.green_ + pixel.red_;
+        }
+    }
+    return sum;
+}
+
+// A smooth gradient with some noise on top: flat areas for the blurs and edges for edge detection.
+Image MakeSyntheticImage(size_t width, size_t height) {
+    Image image(width, height);
+    ThreadPool::GetDefault().ParallelFor(height, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+            std::span<Pixel> row = image.GetRowSpan(y);
+            for (size_t x = 0; x < width; ++x) {
+                uint32_t noise = static_cast<uint32_t>(x * 73856093u ^ y * 19349663u);
+                noise = (noise ^ (noise >> 13)) * 0x5bd1e995u;
+                uint8_t shade = static_cast<uint8_t>((x * 255 / width + y * 255 / height) / 2);
+                row[x] = {static_cast<uint8_t>(shade + (noise & 15)), static_cast<uint8_t>(255 - shade),
+                          static_cast<uint8_t>(((x / 64 + y / 64) % 2) * 192 + ((noise >> 8) & 63))};
+            }
+        }
+    });
+    return image;
+}
+
+std::vector<std::unique_ptr<Filter>> ParseChain(const std::string& chain, size_t width, size_t height) {
+    std::istringstream fields(chain);
+    std::vector<std::string> words = {PROGRAM_NAME, "in.bmp", "out.bmp"};
+    for (std::string word; fields >> word;) {
+        words.push_back(word);
+        if (word == "-crop") {
+            words.push_back(std::to_string(width / 2));
+            words.push_back(std::to_string(height / 2));
+        }
+    }
+    std::vector<char*> args;
+    for (std::string& word : words) {
+        args.push_back(word.data());
+    }
+    CommandParser parsed_chain(static_cast<int>(args.size()), args.data());
+    return PlanFilters(CreateFilters(parsed_chain.GetFiltersData().filters));
+}
+
+// Runs the case the given number of times and keeps the fastest run; setup runs before every repetition and is not
+// timed.
+BenchResult Measure(const std::string& name, size_t width, size_t height, size_t repetitions,
+                    const std::function<void()>& setup, const std::function<void()>& body) {
+    BenchResult result = {name, width, height, 0, 0};
+    for (size_t repetition = 0; repetition < repetitions; ++repetition) {
+        setup();
+        StartMeasuringMemory();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        result.peak_rss = std::max(result.peak_rss, Profiler::GetPeakRss());
+        if (repetition == 0 || elapsed.count() < result.seconds) {
+            result.seconds = elapsed.count();
+        }
+    }
+    return result;
+}
+
+double GetMegapixels(const BenchResult& result) {
+    return static_cast<double>(result.width) * static_cast<double>(result.height) / 1e6;
+}
+
+void PrintText(const BenchResult& result) {
+    std::cout << std::left << std::setw(48) << result.name << std::right << std::setw(12)
+              << (std::to_string(result.width) + "x" + std::to_string(result.height)) << std::fixed
+              << std::setprecision(4) << std::setw(12) << result.seconds << " s" << std::setprecision(1)
+              << std::setw(10) << GetMegapixels(result) / result.seconds << " MP/s" << std::setw(10)
+              << static_cast<double>(result.peak_rss) / (1 << 20) << " MB" << std::endl;
+}
+
+std::string QuoteJson(const std::string& text) {
+    std::string quoted = "\"";
+    for (char symbol : text) {
+        if (symbol == '"' || symbol == '\\') {
+            quoted += '\\';
+        }
+        quoted += symbol;
+    }
+    return quoted + "\"";
+}
+
+// One object per line, so that runs of two commits can be joined on name and size.
+void PrintJson(const BenchResult& result) {
+    std::cout << "{\"name\": " << QuoteJson(result.name) << ", \"width\": " << result.width
+              << ", \"height\": " << result.height << std::fixed << std::setprecision(6)
+              << ", \"seconds\": " << result.seconds << std::setprecision(3)
+              << ", \"megapixels_per_second\": " << GetMegapixels(result) / result.seconds
+              << ", \"peak_rss_bytes\": " << result.peak_rss << "}" << std::endl;
+}
+
+BenchOptions ParseBenchOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg(argv[i]);
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (arg == "--json") {
+            options.json = true;
+            continue;
+        }
+        if (value == nullptr) {
+            throw std::invalid_argument("Unknown option or missing value: " + std::string(arg));
+        }
+        ++i;
+        if (arg == "--sizes") {
+            options.megapixels.clear();
+            std::istringstream sizes(value);
+            for (std::string size; std::getline(sizes, size, ',');) {
+                double megapixels = std::stod(size);
+                if (megapixels <= 0) {
+                    throw std::invalid_argument("Image sizes must be positive numbers of megapixels");
+                }
+                options.megapixels.push_back(megapixels);
+            }
+        } else if (arg == "--repetitions" || arg == "--threads") {
+            int count = std::stoi(value);
+            if (count <= 0) {
+                throw std::invalid_argument("Option " + std::string(arg) + " takes a positive integer value");
+            }
+            (arg == "--threads" ? options.threads : options.repetitions) = static_cast<size_t>(count);
+        } else {
+            throw std::invalid_argument("Unknown option " + std::string(arg));
+        }
+    }
+    return options;
+}
+
+void RunBenchmarks(const BenchOptions& options) {
+    std::filesystem::path temp_dir = std::filesystem::temp_directory_path();
+    std::string suffix = "_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".bmp";
+    std::filesystem::path input_path = temp_dir / ("image_processor_bench_input" + suffix);
+    std::filesystem::path output_path = temp_dir / ("image_processor_bench_output" + suffix);
+    auto print = options.json ? PrintJson : PrintText;
+    auto nothing = [] {};
+    uint64_t checksum = 0;
+
+    for (double megapixels : options.megapixels) {
+        // 4:3, the most common camera aspect ratio.
+        size_t width = std::max<size_t>(1, std::lround(std::sqrt(megapixels * 1e6 * 4 / 3)));
+        size_t height = std::max<size_t>(1, std::lround(megapixels * 1e6 / static_cast<double>(width)));
+        const Image source = MakeSyntheticImage(width, height);
+        Bmp(source).Save(input_path);
+
+        print(Measure("decode", width, height, options.repetitions, nothing, [&] { checksum += ReadAllPixels(Bmp(input_path)); }));
+        {
+            Bmp encoded(source);
+            print(Measure("encode", width, height, options.repetitions, nothing,
+                          [&] { encoded.Save(output_path); }));
+        }
+
+        std::vector<std::string> cases = SINGLE_FILTERS;
+        cases.insert(cases.end(), CHAINS.begin(), CHAINS.end());
+        for (const std::string& chain : cases) {
+            std::vector<std::unique_ptr<Filter>> filters = ParseChain(chain, width, height);
+            Image input;
+            print(Measure(chain, width, height, options.repetitions, [&] { input = source; },
+                          [&] { Image result = ApplyFilters(filters, std::move(input)); }));
+        }
+
+        // The whole job as the command line runs it, from the file to the file.
+        std::vector<std::unique_ptr<Filter>> filters = ParseChain(CHAINS.front(), width, height);
+        ProcessingOptions processing;
+        print(Measure("process " + CHAINS.front(), width, height, options.repetitions, nothing,
+                      [&] { ProcessImage(input_path, output_path, filters, processing); }));
+        processing.streaming = true;
+        print(Measure("process --stream " + CHAINS.front(), width, height, options.repetitions, nothing,
+                      [&] { ProcessImage(input_path, output_path, filters, processing); }));
+    }
+    std::filesystem::remove(input_path);
+    std::filesystem::remove(output_path);
+    if (checksum == 0) {
+        std::cerr << "All decoded images were black" << std::endl;
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    try {
+        BenchOptions options = ParseBenchOptions(argc, argv);
+        ThreadPool::SetDefaultThreadCount(options.threads);
+        RunBenchmarks(options);
+    } catch (const std::exception& error) {
+        std::cerr << PROGRAM_NAME << ": " << error.what() << std::endl;
+        std::cerr << "Usage: " << PROGRAM_NAME << " [--sizes 1,10,100] [--repetitions N] [--threads N] [--json]"
+                  << std::endl;
+        return 1;
+    }
+    return 0;
+}